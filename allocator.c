@@ -0,0 +1,41 @@
+#include <stdlib.h>
+#include "allocator.h"
+
+static void *malloc_alloc(void *arg, size_t size)
+{
+	(void) arg;
+	return malloc(size);
+}
+
+static void malloc_free(void *arg, void *ptr, size_t size)
+{
+	(void) arg;
+	(void) size;
+	free(ptr);
+}
+
+const struct allocator allocator_malloc = {
+	.alloc = malloc_alloc,
+	.free = malloc_free,
+	.arg = NULL
+};
+
+void *allocator_new(const struct allocator *inst, size_t size)
+{
+	if (inst == NULL) {
+		inst = &allocator_malloc;
+	}
+	void *ptr = inst->alloc(inst->arg, size);
+	if (ptr == NULL) {
+		exit(12);
+	}
+	return ptr;
+}
+
+void allocator_delete(const struct allocator *inst, void *ptr, size_t size)
+{
+	if (inst == NULL) {
+		inst = &allocator_malloc;
+	}
+	inst->free(inst->arg, ptr, size);
+}
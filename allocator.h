@@ -0,0 +1,22 @@
+#pragma once
+#include <stddef.h>
+
+/* Pluggable memory source for container nodes */
+
+typedef void *allocator_alloc(void *arg, size_t size);
+
+/* Size is the one which was passed to allocator_alloc */
+typedef void allocator_free(void *arg, void *ptr, size_t size);
+
+struct allocator {
+	allocator_alloc *alloc;
+	allocator_free *free;
+	void *arg;
+};
+
+/* malloc/free, used by containers when no allocator is given */
+extern const struct allocator allocator_malloc;
+
+/* Allocate via allocator (NULL for malloc), exits on failure */
+void *allocator_new(const struct allocator *inst, size_t size);
+void allocator_delete(const struct allocator *inst, void *ptr, size_t size);
@@ -0,0 +1,317 @@
+#if 0
+(
+set -euo pipefail
+declare -r tmp="$(mktemp)"
+gcc -I./c_modules -Wall -Wextra -Werror -std=c11 -O0 -g -pthread -DTEST_arena -o "$tmp" *.c
+exec valgrind --quiet --leak-check=full --track-origins=yes "$tmp"
+)
+exit 0
+#endif
+#include <cstd/std.h>
+#include "arena.h"
+
+static void *arena_alloc_proxy(void *arg, size_t size)
+{
+	return arena_alloc(arg, size);
+}
+
+static void arena_free_proxy(void *arg, void *ptr, size_t size)
+{
+	(void) arg;
+	(void) ptr;
+	(void) size;
+}
+
+void arena_init(struct arena *inst, size_t chunk_size)
+{
+	inst->first = NULL;
+	inst->chunk = NULL;
+	inst->used = 0;
+	inst->chunk_size = chunk_size ? chunk_size : ARENA_DEFAULT_CHUNK_SIZE;
+	inst->last = NULL;
+	inst->allocator.alloc = arena_alloc_proxy;
+	inst->allocator.free = arena_free_proxy;
+	inst->allocator.arg = inst;
+}
+
+static void free_chunks(struct arena_chunk *chunk)
+{
+	while (chunk != NULL) {
+		struct arena_chunk *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+}
+
+void arena_destroy(struct arena *inst)
+{
+	free_chunks(inst->first);
+	inst->first = NULL;
+	inst->chunk = NULL;
+	inst->used = 0;
+	inst->last = NULL;
+}
+
+/* Offset in chunk of the first address at or after <used> with alignment */
+static size_t align_in(const struct arena_chunk *chunk, size_t used, size_t alignment)
+{
+	const uintptr_t addr = (uintptr_t) (chunk->data + used);
+	return used + ((alignment - addr % alignment) % alignment);
+}
+
+static bool fits(const struct arena_chunk *chunk, size_t used, size_t size, size_t alignment)
+{
+	const size_t offset = align_in(chunk, used, alignment);
+	return offset <= chunk->size && size <= chunk->size - offset;
+}
+
+/* Move to the next retained chunk which fits, or add one after the current */
+static void next_chunk(struct arena *inst, size_t size, size_t alignment)
+{
+	struct arena_chunk *chunk = inst->chunk ? inst->chunk->next : inst->first;
+	while (chunk != NULL && !fits(chunk, 0, size, alignment)) {
+		chunk = chunk->next;
+	}
+	if (chunk == NULL) {
+		size_t bytes = size + alignment;
+		if (bytes < inst->chunk_size) {
+			bytes = inst->chunk_size;
+		}
+		chunk = malloc(sizeof(*chunk) + bytes);
+		if (chunk == NULL) {
+			exit(12);
+		}
+		chunk->size = bytes;
+		chunk->prev = inst->chunk;
+		if (inst->chunk != NULL) {
+			chunk->next = inst->chunk->next;
+			inst->chunk->next = chunk;
+		} else {
+			chunk->next = inst->first;
+			inst->first = chunk;
+		}
+		if (chunk->next != NULL) {
+			chunk->next->prev = chunk;
+		}
+	}
+	inst->chunk = chunk;
+	inst->used = 0;
+}
+
+void *arena_alloc_aligned(struct arena *inst, size_t size, size_t alignment)
+{
+	if (inst->chunk == NULL || !fits(inst->chunk, inst->used, size, alignment)) {
+		next_chunk(inst, size, alignment);
+	}
+	const size_t offset = align_in(inst->chunk, inst->used, alignment);
+	void *ptr = inst->chunk->data + offset;
+	inst->used = offset + size;
+	inst->last = ptr;
+	return ptr;
+}
+
+void *arena_alloc(struct arena *inst, size_t size)
+{
+	return arena_alloc_aligned(inst, size, _Alignof(max_align_t));
+}
+
+void *arena_realloc(struct arena *inst, void *ptr, size_t old_size, size_t new_size)
+{
+	if (ptr == NULL) {
+		return arena_alloc(inst, new_size);
+	}
+	if (ptr == inst->last) {
+		const size_t offset = (char *) ptr - inst->chunk->data;
+		if (new_size <= inst->chunk->size - offset) {
+			inst->used = offset + new_size;
+			return ptr;
+		}
+	}
+	if (new_size <= old_size) {
+		return ptr;
+	}
+	void *moved = arena_alloc(inst, new_size);
+	memcpy(moved, ptr, old_size);
+	return moved;
+}
+
+struct arena_mark arena_mark(struct arena *inst)
+{
+	struct arena_mark mark = { .chunk = inst->chunk, .used = inst->used };
+	/* Growing an older allocation in place would cross the mark */
+	inst->last = NULL;
+	return mark;
+}
+
+void arena_release(struct arena *inst, struct arena_mark mark)
+{
+	inst->chunk = mark.chunk;
+	inst->used = mark.used;
+	inst->last = NULL;
+}
+
+void arena_reset(struct arena *inst)
+{
+	inst->chunk = NULL;
+	inst->used = 0;
+	inst->last = NULL;
+}
+
+void arena_trim(struct arena *inst)
+{
+	if (inst->chunk == NULL) {
+		free_chunks(inst->first);
+		inst->first = NULL;
+		return;
+	}
+	free_chunks(inst->chunk->next);
+	inst->chunk->next = NULL;
+}
+
+const struct allocator *arena_allocator(struct arena *inst)
+{
+	return &inst->allocator;
+}
+
+#if defined TEST_arena
+#include <time.h>
+#include "binary_tree.h"
+#include "linked_list.h"
+#include "buffer.h"
+
+static void test_marks(void)
+{
+	struct arena arena;
+	arena_init(&arena, 256);
+	char *a = arena_alloc(&arena, 100);
+	memset(a, 'a', 100);
+	struct arena_mark mark = arena_mark(&arena);
+	char *b = arena_alloc(&arena, 1000);
+	memset(b, 'b', 1000);
+	double *d = arena_alloc_aligned(&arena, sizeof(*d), 64);
+	printf("Marks\n");
+	printf(" * Aligned to 64: %d\n", (uintptr_t) d % 64 == 0);
+	arena_release(&arena, mark);
+	printf(" * Release reuses memory after the mark: %d\n", arena_alloc(&arena, 100) == a + 112);
+	size_t lost = 0;
+	for (size_t i = 0; i < 100; i++) {
+		lost += a[i] != 'a';
+	}
+	printf(" * Bytes lost before the mark: %zu\n", lost);
+	char *c = arena_alloc(&arena, 16);
+	printf(" * Latest allocation grows in place: %d\n", arena_realloc(&arena, c, 16, 32) == c);
+	printf(" * Growth past the chunk moves: %d\n", arena_realloc(&arena, c, 32, 64) != c);
+	arena_reset(&arena);
+	printf(" * Reset reuses the first chunk: %d\n", arena_alloc(&arena, 100) == a);
+	arena_destroy(&arena);
+	printf("\n");
+}
+
+/* Storage allocated before a mark and grown after it must survive release */
+static void test_grow_across_mark(void)
+{
+	struct arena arena;
+	arena_init(&arena, 0);
+	struct buffer buf;
+	buffer_init_arena(&buf, sizeof(size_t), 64, &arena);
+	for (size_t i = 0; i < 64; i++) {
+		buffer_push(&buf, &i);
+	}
+	const size_t *before = buffer_cdata(&buf);
+	struct arena_mark mark = arena_mark(&arena);
+	for (size_t i = 64; i < 1000; i++) {
+		buffer_push(&buf, &i);
+	}
+	/* Unless it moved past the mark, the buffer still owns all of its items */
+	const size_t owned = buffer_cdata(&buf) == before ? buf.length : 64;
+	arena_release(&arena, mark);
+	memset(arena_alloc(&arena, 1000 * sizeof(size_t)), 0xff, 1000 * sizeof(size_t));
+	size_t lost = 0;
+	for (size_t i = 0; i < owned; i++) {
+		lost += before[i] != i;
+	}
+	printf("Growth across a mark\n");
+	printf(" * Items lost after release: %zu of %zu\n", lost, owned);
+	printf("\n");
+	arena_destroy(&arena);
+}
+
+static void test_containers(void)
+{
+	struct arena arena;
+	arena_init(&arena, 0);
+
+	struct buffer buf;
+	buffer_init_arena(&buf, sizeof(size_t), 4, &arena);
+	for (size_t i = 0; i < 10000; i++) {
+		buffer_push(&buf, &i);
+	}
+	struct buffer_stats stats;
+	buffer_stats(&buf, &stats);
+	size_t errors = 0;
+	for (size_t i = 0; i < 10000; i++) {
+		errors += *(size_t *) buffer_get(&buf, i) != i;
+	}
+	printf("Containers\n");
+	printf(" * Buffer: %zu reallocs, %zu bytes copied, errors=%zu\n", stats.reallocs, stats.bytes_copied, errors);
+
+	struct list_handle list;
+	list_handle_init(&list, arena_allocator(&arena));
+	for (size_t i = 0; i < 1000; i++) {
+		list_handle_push_back(&list, sizeof(i), &i);
+	}
+	struct binary_tree tree;
+	binary_tree_init(&tree, NULL, NULL, NULL);
+	binary_tree_set_allocator(&tree, arena_allocator(&arena));
+	for (size_t i = 0; i < 1000; i++) {
+		binary_tree_insert_new(&tree, &i, sizeof(i));
+	}
+	printf(" * List length %zu, tree size %zu\n", list_handle_length(&list), binary_tree_size(&tree));
+	printf("\n");
+	arena_destroy(&arena);
+}
+
+/* Build then discard a tree of n keys <rounds> times */
+static void bench_tree(size_t n, size_t rounds)
+{
+	struct binary_tree tree;
+	struct arena arena;
+	arena_init(&arena, 0);
+	double build[2] = { 0, 0 };
+	double teardown[2] = { 0, 0 };
+	for (int use_arena = 0; use_arena < 2; use_arena++) {
+		for (size_t r = 0; r < rounds; r++) {
+			binary_tree_init(&tree, NULL, NULL, NULL);
+			binary_tree_set_allocator(&tree, use_arena ? arena_allocator(&arena) : NULL);
+			clock_t start = clock();
+			for (size_t i = 0; i < n; i++) {
+				const int key = rand();
+				binary_tree_insert_new(&tree, &key, sizeof(key));
+			}
+			build[use_arena] += (double) (clock() - start) / CLOCKS_PER_SEC;
+			start = clock();
+			if (use_arena) {
+				arena_reset(&arena);
+			} else {
+				binary_tree_destroy(&tree);
+			}
+			teardown[use_arena] += (double) (clock() - start) / CLOCKS_PER_SEC;
+		}
+	}
+	arena_destroy(&arena);
+	printf("Tree of %zu keys, %zu rounds (build / teardown)\n", n, rounds);
+	printf(" * malloc: %.3fs / %.3fs\n", build[0], teardown[0]);
+	printf(" * arena:  %.3fs / %.3fs\n", build[1], teardown[1]);
+}
+
+int main(int argc, char *argv[])
+{
+	const size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 200000;
+	const size_t rounds = argc > 2 ? strtoul(argv[2], NULL, 10) : 5;
+	test_marks();
+	test_grow_across_mark();
+	test_containers();
+	bench_tree(n, rounds);
+	return 0;
+}
+#endif
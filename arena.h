@@ -0,0 +1,74 @@
+#pragma once
+#include <cstd/std.h>
+#include "allocator.h"
+
+/*
+ * Bump-pointer region allocator.  Memory is carved sequentially from chunks
+ * and only reclaimed in bulk: by releasing to a mark, or by resetting the
+ * whole arena.  Both are O(1) and keep the chunks for reuse.
+ *
+ * Containers take an arena via arena_allocator (binary_tree_set_allocator,
+ * list_handle_init) or buffer_init_arena.  Containers whose memory is
+ * reclaimed by a release or reset are discarded without destroying them
+ * (destructors do not run) and must be initialised again before reuse.
+ */
+
+#define ARENA_DEFAULT_CHUNK_SIZE ((size_t) 64 << 10)
+
+struct arena_chunk {
+	struct arena_chunk *prev;
+	struct arena_chunk *next;
+	/* Bytes in data */
+	size_t size;
+	_Alignas(max_align_t) char data[];
+};
+
+struct arena {
+	struct arena_chunk *first;
+	/* Chunk being allocated from, NULL if none yet */
+	struct arena_chunk *chunk;
+	/* Bytes used in chunk */
+	size_t used;
+	size_t chunk_size;
+	/* Most recent allocation, which arena_realloc can resize in place */
+	void *last;
+	/* Interface for containers, see arena_allocator */
+	struct allocator allocator;
+};
+
+/* Checkpoint, see arena_mark */
+struct arena_mark {
+	struct arena_chunk *chunk;
+	size_t used;
+};
+
+/* Chunk size in bytes, 0 for the default */
+void arena_init(struct arena *inst, size_t chunk_size);
+void arena_destroy(struct arena *inst);
+
+/* Aligned for any type */
+void *arena_alloc(struct arena *inst, size_t size);
+/* Alignment must be a power of two */
+void *arena_alloc_aligned(struct arena *inst, size_t size, size_t alignment);
+
+/*
+ * Resize an allocation, in place if it is the most recent one and there is
+ * room, otherwise by copying to a new allocation
+ */
+void *arena_realloc(struct arena *inst, void *ptr, size_t old_size, size_t new_size);
+
+/*
+ * Free everything allocated after the mark was taken.  Allocations made
+ * before the mark are no longer grown in place, so they stay below it.
+ */
+struct arena_mark arena_mark(struct arena *inst);
+void arena_release(struct arena *inst, struct arena_mark mark);
+
+/* Free everything */
+void arena_reset(struct arena *inst);
+
+/* Return chunks which are not in use to the system */
+void arena_trim(struct arena *inst);
+
+/* For passing to containers, frees are no-ops */
+const struct allocator *arena_allocator(struct arena *inst);
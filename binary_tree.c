@@ -2,7 +2,7 @@
 (
 set -euo pipefail
 declare -r tmp="$(mktemp)"
-gcc -I./c_modules -Wall -Wextra -Werror -std=c11 -O0 -g -DTEST_binary_tree -o "$tmp" *.c
+gcc -I./c_modules -Wall -Wextra -Werror -std=c11 -O0 -g -pthread -DTEST_binary_tree -o "$tmp" *.c
 exec valgrind --quiet --leak-check=full --track-origins=yes "$tmp"
 )
 exit 0
@@ -32,6 +32,12 @@ void binary_tree_init(struct binary_tree *inst, binary_tree_comparator *cmp, voi
 	inst->cmparg = cmparg;
 	inst->destroy = destructor;
 	inst->size = 0;
+	inst->alloc = NULL;
+}
+
+void binary_tree_set_allocator(struct binary_tree *inst, const struct allocator *alloc)
+{
+	inst->alloc = alloc;
 }
 
 size_t binary_tree_size(struct binary_tree *inst)
@@ -77,9 +83,9 @@ static struct binary_tree_node *unset_node(struct binary_tree *inst, struct bina
 	return node;
 }
 
-static struct binary_tree_node *do_create(const void *data, size_t length)
+static struct binary_tree_node *do_create(struct binary_tree *inst, const void *data, size_t length)
 {
-	struct binary_tree_node *node = malloc(sizeof(*node) + length);
+	struct binary_tree_node *node = allocator_new(inst->alloc, sizeof(*node) + length);
 	memset(node->children, 0, sizeof(node->children));
 	node->length = length;
 	memcpy(node->data, data, length);
@@ -95,7 +101,7 @@ static void do_destroy(struct binary_tree *inst, struct binary_tree_node **pos)
 	if (inst->destroy) {
 		inst->destroy(node->data, node->length);
 	}
-	free(node);
+	allocator_delete(inst->alloc, node, sizeof(*node) + node->length);
 }
 
 static bool do_insert(struct binary_tree *inst, struct binary_tree_node *node)
@@ -136,7 +142,7 @@ struct binary_tree_node **binary_tree_insert(struct binary_tree *inst, const voi
 		*isnew = is_new;
 	}
 	if (is_new) {
-		set_node(inst, pos, do_create(data, length));
+		set_node(inst, pos, do_create(inst, data, length));
 	}
 	return pos;
 }
@@ -160,7 +166,7 @@ bool binary_tree_replace(struct binary_tree *inst, const void *data, size_t leng
 		unset_node(inst, &(*p)->children[1])
 	};
 	binary_tree_delete(inst, p);
-	set_node(inst, p, do_create(data, length));
+	set_node(inst, p, do_create(inst, data, length));
 	set_node(inst, &(*p)->children[0], children[0]);
 	set_node(inst, &(*p)->children[1], children[1]);
 	return true;
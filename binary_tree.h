@@ -1,5 +1,6 @@
 #pragma once
 #include <cstd/std.h>
+#include "allocator.h"
 
 /*
  * Do not edit the key of a node within the tree.
@@ -24,10 +25,18 @@ struct binary_tree {
 	binary_tree_destructor *destroy;
 	void *cmparg;
 	size_t size;
+	/* Node allocator, NULL for malloc */
+	const struct allocator *alloc;
 };
 
 void binary_tree_init(struct binary_tree *inst, binary_tree_comparator *cmp, void *cmparg, binary_tree_destructor *destructor);
 
+/*
+ * Allocate nodes from alloc (e.g. slab_alloc_allocator) instead of malloc,
+ * tree must be empty.  NULL restores malloc.
+ */
+void binary_tree_set_allocator(struct binary_tree *inst, const struct allocator *alloc);
+
 /* Number of items in the tree */
 size_t binary_tree_size(struct binary_tree *inst);
 
@@ -2,7 +2,7 @@
 (
 set -euo pipefail
 declare -r tmp="$(mktemp)"
-gcc -I./c_modules -Wall -Wextra -Werror -std=c11 -O0 -g -DTEST_binary_tree_iterator -o "$tmp" *.c
+gcc -I./c_modules -Wall -Wextra -Werror -std=c11 -O0 -g -pthread -DTEST_binary_tree_iterator -o "$tmp" *.c
 exec valgrind --quiet --leak-check=full --track-origins=yes "$tmp"
 )
 exit 0
@@ -10,24 +10,36 @@ exit 0
 #include <cstd/std.h>
 #include "binary_tree_iterator.h"
 
+/*
+ * The inline stack points into the iterator itself, so follow the iterator if
+ * it was copied or moved since the last call
+ */
+static struct buffer *stack(struct binary_tree_iterator *inst)
+{
+	if (inst->stack.storage == BUFFER_STORAGE_INLINE) {
+		inst->stack.data = inst->stack_storage;
+	}
+	return &inst->stack;
+}
+
 static void enter(struct binary_tree_iterator *inst, struct binary_tree_node **node)
 {
 	for (; *node; node = &(*node)->children[inst->reverse ? 1 : 0]) {
-		buffer_push(&inst->stack, &node);
+		buffer_push(stack(inst), &node);
 	}
 }
 
 void binary_tree_iter_init(struct binary_tree_iterator *inst, struct binary_tree *tree, bool reverse)
 {
 	inst->reverse = reverse;
-	buffer_init(&inst->stack, sizeof(struct binary_tree_node *), 64, 64);
+	buffer_init_inline(&inst->stack, sizeof(*inst->stack_storage), inst->stack_storage, BINARY_TREE_ITER_INLINE_DEPTH, BINARY_TREE_ITER_INLINE_DEPTH);
 	enter(inst, &tree->root);
 }
 
 struct binary_tree_node **binary_tree_iter_next_node(struct binary_tree_iterator *inst)
 {
 	struct binary_tree_node **node;
-	if (!buffer_pop(&inst->stack, &node)) {
+	if (!buffer_pop(stack(inst), &node)) {
 		return NULL;
 	}
 	enter(inst, &(*node)->children[inst->reverse ? 0 : 1]);
@@ -109,6 +121,17 @@ int main(int argc, char *argv[])
 	binary_tree_iter_destroy(&it);
 	printf("\n");
 
+	printf("Iterator sequence (copied after first item):\n");
+	binary_tree_iter_init(&it, &tree, false);
+	printf(" * %d\n", *(const int *) binary_tree_iter_next(&it, NULL));
+	struct binary_tree_iterator copy = it;
+	memset(&it, 0xff, sizeof(it));
+	while ((p = (const int *) binary_tree_iter_next(&copy, NULL))) {
+		printf(" * %d\n", *p);
+	}
+	binary_tree_iter_destroy(&copy);
+	printf("\n");
+
 	binary_tree_destroy(&tree);
 	return 0;
 }
@@ -3,9 +3,16 @@
 #include "buffer.h"
 #include "binary_tree.h"
 
+#define BINARY_TREE_ITER_INLINE_DEPTH 64
+
 struct binary_tree_iterator {
 	struct buffer stack;
 	bool reverse;
+	/*
+	 * Stack lives here unless the tree is deeper than this, the iterator may
+	 * be copied or returned by value (but only one copy may be used)
+	 */
+	struct binary_tree_node **stack_storage[BINARY_TREE_ITER_INLINE_DEPTH];
 };
 
 void binary_tree_iter_init(struct binary_tree_iterator *inst, struct binary_tree *tree, bool reverse);
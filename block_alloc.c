@@ -1,22 +1,94 @@
+#if 0
+(
+set -euo pipefail
+declare -r tmp="$(mktemp)"
+gcc -I./c_modules -Wall -Wextra -Werror -std=c11 -O0 -g -pthread -DTEST_block_alloc -o "$tmp" *.c
+exec valgrind --quiet --leak-check=full --track-origins=yes "$tmp"
+)
+exit 0
+#endif
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include "block_alloc.h"
 
-#define MASK_WIDTH (sizeof(size_t) * 8)
-#define MASK_EMPTY ((size_t) -1)
-#define MASK_FULL ((size_t) 0)
-#define HIGHBIT ((size_t) 1 << (MASK_WIDTH - 1))
-// For SSE4: #define MASKBIT(n) (HIGHBIT >> n)
-#define MASKBIT(n) ((size_t) 1 << n)
+#define WORD_BITS (sizeof(size_t) * 8)
+#define BIT(n) ((size_t) 1 << (n))
+/* Alignment of first item in a block */
+#define DATA_ALIGN ((size_t) 16)
 
-void block_alloc_init(struct block_alloc *inst, size_t item_size)
+/* Index of lowest set bit, x must be non-zero */
+static unsigned lowest_set(size_t x)
+{
+#if defined __GNUC__
+	return __builtin_ctzll(x);
+#else
+	unsigned n = 0;
+	for (; !(x & 1); x >>= 1) {
+		n++;
+	}
+	return n;
+#endif
+}
+
+static size_t words_for(size_t bits)
+{
+	return (bits + WORD_BITS - 1) / WORD_BITS;
+}
+
+/* Lay out bitmaps and items for the largest slot count that fits */
+static void layout(struct block_alloc *inst)
+{
+	size_t slots = (inst->block_size - sizeof(struct block_alloc_blk)) / inst->item_size;
+	for (;; slots--) {
+		inst->leaf_words = words_for(slots);
+		inst->summary_words = words_for(inst->leaf_words);
+		const size_t header = sizeof(struct block_alloc_blk) + (inst->summary_words + inst->leaf_words) * sizeof(size_t);
+		inst->data_offset = (header + DATA_ALIGN - 1) / DATA_ALIGN * DATA_ALIGN;
+		if (inst->data_offset + slots * inst->item_size <= inst->block_size) {
+			break;
+		}
+	}
+	inst->slots = slots;
+}
+
+void block_alloc_init_size(struct block_alloc *inst, size_t item_size, size_t block_size)
 {
+	/* Smallest power of two not below block_size with room for an item */
+	const size_t min = sizeof(struct block_alloc_blk) + 2 * sizeof(size_t) + DATA_ALIGN + item_size;
+	size_t size = 1;
+	while (size < block_size || size < min) {
+		size *= 2;
+	}
 	inst->item_size = item_size;
-	inst->block_size = sizeof(*inst->head) + item_size * MASK_WIDTH;
+	inst->block_size = size;
+	layout(inst);
 	inst->head = NULL;
 	inst->tail = NULL;
+	inst->free_head = NULL;
+	inst->items = 0;
+	inst->blocks = 0;
+	inst->peak_items = 0;
+	inst->peak_blocks = 0;
+	inst->hook = NULL;
+	inst->hook_arg = NULL;
+	inst->sample_period = 0;
+	inst->sample_countdown = 0;
+}
+
+void block_alloc_init(struct block_alloc *inst, size_t item_size)
+{
+	/*
+	 * Largest power of two not above the size of a 64-item block, so less
+	 * than one item is wasted per block
+	 */
+	const size_t full = sizeof(struct block_alloc_blk) + 2 * sizeof(size_t) + DATA_ALIGN + item_size * WORD_BITS;
+	size_t block_size = 1;
+	while (block_size * 2 <= full) {
+		block_size *= 2;
+	}
+	block_alloc_init_size(inst, item_size, block_size);
 }
 
 void block_alloc_destroy(struct block_alloc *inst)
@@ -29,10 +101,44 @@ void block_alloc_destroy(struct block_alloc *inst)
 	}
 }
 
+static void free_list_insert(struct block_alloc *inst, struct block_alloc_blk *blk)
+{
+	blk->free_prev = NULL;
+	blk->free_next = inst->free_head;
+	if (inst->free_head) {
+		inst->free_head->free_prev = blk;
+	}
+	inst->free_head = blk;
+}
+
+static void free_list_remove(struct block_alloc *inst, struct block_alloc_blk *blk)
+{
+	if (blk->free_prev) {
+		blk->free_prev->free_next = blk->free_next;
+	} else {
+		inst->free_head = blk->free_next;
+	}
+	if (blk->free_next) {
+		blk->free_next->free_prev = blk->free_prev;
+	}
+}
+
 static struct block_alloc_blk *block_new(struct block_alloc *inst)
 {
-	struct block_alloc_blk *blk = malloc(inst->block_size);
-	blk->mask = MASK_EMPTY;
+	struct block_alloc_blk *blk = aligned_alloc(inst->block_size, inst->block_size);
+	if (blk == NULL) {
+		exit(12);
+	}
+	size_t *summary = blk->bitmap;
+	size_t *leaf = blk->bitmap + inst->summary_words;
+	memset(blk->bitmap, 0, (inst->summary_words + inst->leaf_words) * sizeof(size_t));
+	for (size_t w = 0; w < inst->leaf_words; w++) {
+		const size_t bits = inst->slots - w * WORD_BITS;
+		leaf[w] = bits >= WORD_BITS ? (size_t) -1 : BIT(bits) - 1;
+		summary[w / WORD_BITS] |= BIT(w % WORD_BITS);
+	}
+	blk->free = inst->slots;
+	blk->owner = inst;
 	blk->next = NULL;
 	if (inst->head == NULL) {
 		inst->head = blk;
@@ -43,56 +149,257 @@ static struct block_alloc_blk *block_new(struct block_alloc *inst)
 		blk->prev = inst->tail;
 		inst->tail = blk;
 	}
+	free_list_insert(inst, blk);
+	if (++inst->blocks > inst->peak_blocks) {
+		inst->peak_blocks = inst->blocks;
+	}
 	return blk;
 }
 
 static void block_delete(struct block_alloc *inst, struct block_alloc_blk *blk)
 {
-	if (blk == inst->head) {
-		inst->head = NULL;
-		inst->tail = NULL;
-	} else {
+	if (blk->prev) {
 		blk->prev->next = blk->next;
+	} else {
+		inst->head = blk->next;
+	}
+	if (blk->next) {
 		blk->next->prev = blk->prev;
+	} else {
+		inst->tail = blk->prev;
 	}
+	free_list_remove(inst, blk);
+	inst->blocks--;
 	free(blk);
 }
 
+static void sample(struct block_alloc *inst, void *item, bool allocated)
+{
+	if (--inst->sample_countdown == 0) {
+		inst->sample_countdown = inst->sample_period;
+		inst->hook(inst->hook_arg, inst, item, allocated);
+	}
+}
+
+static struct block_alloc_blk *block_of(const struct block_alloc *inst, const void *item)
+{
+	return (struct block_alloc_blk *) ((uintptr_t) item & ~(uintptr_t) (inst->block_size - 1));
+}
+
 void *block_alloc_new(struct block_alloc *inst)
 {
-	struct block_alloc_blk *blk;
-	if (inst->tail == NULL || inst->tail->mask == MASK_FULL) {
+	struct block_alloc_blk *blk = inst->free_head;
+	if (blk == NULL) {
 		blk = block_new(inst);
-	} else {
-		blk = inst->tail;
 	}
-	/* For SSE4:
-	 * slot = lzcnt(blk->mask)
-	 */
-	int slot = 0;
-	for (size_t mask = blk->mask; !(mask & 1); mask >>= 1) {
-		slot++;
+	size_t *summary = blk->bitmap;
+	size_t *leaf = blk->bitmap + inst->summary_words;
+	size_t s = 0;
+	while (summary[s] == 0) {
+		s++;
 	}
-	blk->mask ^= MASKBIT(slot);
-	return blk->data + (inst->item_size * slot);
+	const size_t w = s * WORD_BITS + lowest_set(summary[s]);
+	const size_t slot = w * WORD_BITS + lowest_set(leaf[w]);
+	leaf[w] &= leaf[w] - 1;
+	if (leaf[w] == 0) {
+		summary[s] &= summary[s] - 1;
+	}
+	if (--blk->free == 0) {
+		free_list_remove(inst, blk);
+	}
+	if (++inst->items > inst->peak_items) {
+		inst->peak_items = inst->items;
+	}
+	void *item = (char *) blk + inst->data_offset + inst->item_size * slot;
+	if (inst->hook) {
+		sample(inst, item, true);
+	}
+	return item;
 }
 
 void block_alloc_delete(struct block_alloc *inst, void *item)
 {
-	const uintptr_t iitem = (uintptr_t) item;
-	for (struct block_alloc_blk *p = inst->head; p; p = p->next) {
-		const uintptr_t ip = (uintptr_t) p;
-		if (iitem < ip + sizeof(*p)) {
-			continue;
-		}
-		if (iitem >= ip + inst->block_size) {
-		       continue;
-		}	       
-		const size_t slot = (iitem - (ip + sizeof(*p))) / inst->item_size;
-		p->mask ^= MASKBIT(slot);
-		if (p->mask == MASK_EMPTY) {
-			block_delete(inst, p);
-		}
+	if (item == NULL) {
 		return;
 	}
+	if (inst->hook) {
+		sample(inst, item, false);
+	}
+	struct block_alloc_blk *blk = block_of(inst, item);
+	const size_t slot = ((char *) item - ((char *) blk + inst->data_offset)) / inst->item_size;
+	const size_t w = slot / WORD_BITS;
+	if (blk->free++ == 0) {
+		free_list_insert(inst, blk);
+	}
+	blk->bitmap[inst->summary_words + w] |= BIT(slot % WORD_BITS);
+	blk->bitmap[w / WORD_BITS] |= BIT(w % WORD_BITS);
+	inst->items--;
+	/* Keep the last block with free slots to avoid thrashing at a boundary */
+	if (blk->free == inst->slots && (blk->free_prev || blk->free_next)) {
+		block_delete(inst, blk);
+	}
+}
+
+struct block_alloc *block_alloc_owner(const struct block_alloc *inst, const void *item)
+{
+	return block_of(inst, item)->owner;
+}
+
+double block_alloc_occupancy(const struct block_alloc *inst)
+{
+	if (inst->blocks == 0) {
+		return 1;
+	}
+	return (double) inst->items / (inst->blocks * inst->slots);
+}
+
+void block_alloc_stats(const struct block_alloc *inst, struct block_alloc_stats *out)
+{
+	out->items = inst->items;
+	out->peak_items = inst->peak_items;
+	out->blocks = inst->blocks;
+	out->peak_blocks = inst->peak_blocks;
+	out->slots = inst->blocks * inst->slots;
+	out->bytes_reserved = inst->blocks * inst->block_size;
+	out->bytes_used = inst->items * inst->item_size;
+	memset(out->histogram, 0, sizeof(out->histogram));
+	const size_t buckets = BLOCK_ALLOC_HISTOGRAM_SIZE - 1;
+	for (const struct block_alloc_blk *blk = inst->head; blk != NULL; blk = blk->next) {
+		/* Free count equals the popcount of the free bitmap */
+		const size_t used = inst->slots - blk->free;
+		out->histogram[used * buckets / inst->slots]++;
+	}
+}
+
+void block_alloc_set_hook(struct block_alloc *inst, block_alloc_hook *hook, void *arg, size_t period)
+{
+	inst->hook = hook;
+	inst->hook_arg = arg;
+	inst->sample_period = period ? period : 1;
+	inst->sample_countdown = inst->sample_period;
+}
+
+#if defined TEST_block_alloc
+#include <stdio.h>
+#include <time.h>
+
+/* Keep <live> items allocated, replace a random one <ops> times */
+static void bench_churn(size_t item_size, size_t live, size_t block_size, size_t ops)
+{
+	void **items = malloc(live * sizeof(*items));
+	struct block_alloc ba;
+	clock_t start;
+
+	if (block_size) {
+		block_alloc_init_size(&ba, item_size, block_size);
+	} else {
+		block_alloc_init(&ba, item_size);
+	}
+	for (size_t i = 0; i < live; i++) {
+		items[i] = block_alloc_new(&ba);
+		memset(items[i], 0, item_size);
+	}
+	start = clock();
+	for (size_t i = 0; i < ops; i++) {
+		const size_t k = rand() % live;
+		block_alloc_delete(&ba, items[k]);
+		items[k] = block_alloc_new(&ba);
+		memset(items[k], 0, item_size);
+	}
+	const double t_block = (double) (clock() - start) / CLOCKS_PER_SEC;
+	const size_t blocks = ba.blocks;
+	const double occupancy = block_alloc_occupancy(&ba);
+	struct block_alloc_stats stats;
+	block_alloc_stats(&ba, &stats);
+	for (size_t i = 0; i < live; i++) {
+		block_alloc_delete(&ba, items[i]);
+	}
+	const bool empty = ba.items == 0 && ba.blocks <= 1;
+	block_alloc_destroy(&ba);
+
+	for (size_t i = 0; i < live; i++) {
+		items[i] = malloc(item_size);
+		memset(items[i], 0, item_size);
+	}
+	start = clock();
+	for (size_t i = 0; i < ops; i++) {
+		const size_t k = rand() % live;
+		free(items[k]);
+		items[k] = malloc(item_size);
+		memset(items[k], 0, item_size);
+	}
+	const double t_malloc = (double) (clock() - start) / CLOCKS_PER_SEC;
+	for (size_t i = 0; i < live; i++) {
+		free(items[i]);
+	}
+	free(items);
+
+	printf(" * live=%-8zu block_alloc %6.1f Mops/s, malloc %6.1f Mops/s, blocks=%zu occupancy=%.2f%s\n", live, ops / t_block * 1e-6, ops / t_malloc * 1e-6, blocks, occupancy, empty ? "" : " (BLOCKS LEAKED)");
+	printf("   peak=%zu reserved=%zuK used=%zuK histogram:", stats.peak_items, stats.bytes_reserved >> 10, stats.bytes_used >> 10);
+	for (size_t i = 0; i < BLOCK_ALLOC_HISTOGRAM_SIZE; i++) {
+		printf(" %zu", stats.histogram[i]);
+	}
+	printf("\n");
+}
+
+struct sampler {
+	size_t samples;
+	ptrdiff_t net;
+};
+
+static void sample_hook(void *arg, struct block_alloc *inst, void *item, bool allocated)
+{
+	struct sampler *s = arg;
+	(void) inst;
+	(void) item;
+	s->samples++;
+	s->net += allocated ? 1 : -1;
+}
+
+/* Sampling every 16th operation over a fill/drain cycle */
+static void test_hook(size_t n)
+{
+	struct block_alloc ba;
+	struct sampler s = { 0, 0 };
+	void **items = malloc(n * sizeof(*items));
+	block_alloc_init(&ba, 32);
+	block_alloc_set_hook(&ba, sample_hook, &s, 16);
+	for (size_t i = 0; i < n; i++) {
+		items[i] = block_alloc_new(&ba);
+	}
+	for (size_t i = 0; i < n; i++) {
+		block_alloc_delete(&ba, items[i]);
+	}
+	free(items);
+	block_alloc_destroy(&ba);
+	printf("Sampling hook: %zu samples of %zu operations, net %td\n", s.samples, 2 * n, s.net);
+}
+
+int main(int argc, char *argv[])
+{
+	const size_t ops = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+	const size_t max_live = argc > 2 ? strtoul(argv[2], NULL, 0) : 1000000;
+
+	test_hook(100000);
+	printf("\n");
+
+	printf("Free/alloc churn, 32-byte items, default blocks\n");
+	for (size_t live = 1000; live <= max_live; live *= 10) {
+		bench_churn(32, live, 0, ops);
+	}
+	printf("\n");
+
+	printf("Free/alloc churn, 32-byte items, 64K blocks\n");
+	for (size_t live = 1000; live <= max_live; live *= 10) {
+		bench_churn(32, live, 65536, ops);
+	}
+	printf("\n");
+
+	printf("Free/alloc churn, 32-byte items, 2M blocks\n");
+	for (size_t live = 1000; live <= max_live; live *= 10) {
+		bench_churn(32, live, 2 << 20, ops);
+	}
+	printf("\n");
+	return 0;
 }
+#endif
@@ -1,25 +1,113 @@
 #pragma once
 #include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Fixed-size item allocator.  Items are carved from blocks (slabs) of a
+ * configurable power-of-two size; each block is aligned to its size so the
+ * owning block of an item is found by masking its address.
+ *
+ * Free slots are tracked by a two-level bitmap following the block header:
+ * a set bit in a leaf word marks a free slot, a set bit in a summary word
+ * marks a leaf word with at least one free slot.  Items follow the bitmaps.
+ */
+
+struct block_alloc;
+
+/*
+ * Sampling hook, called for every period-th new/delete with the item and
+ * whether it was allocated (true) or freed (false)
+ */
+typedef void block_alloc_hook(void *arg, struct block_alloc *inst, void *item, bool allocated);
+
+/* Occupancy buckets: bucket i counts blocks with i/8 to (i+1)/8 slots used, 8 is full */
+#define BLOCK_ALLOC_HISTOGRAM_SIZE 9
+
+struct block_alloc_stats {
+	/* Items allocated now and at most */
+	size_t items;
+	size_t peak_items;
+	/* Blocks held now and at most */
+	size_t blocks;
+	size_t peak_blocks;
+	/* Item slots in held blocks */
+	size_t slots;
+	/* Bytes held in blocks, and bytes of those in allocated items */
+	size_t bytes_reserved;
+	size_t bytes_used;
+	/* Blocks by fraction of slots used */
+	size_t histogram[BLOCK_ALLOC_HISTOGRAM_SIZE];
+};
 
 struct block_alloc_blk {
-	size_t mask;
+	/* Allocator which the block belongs to */
+	struct block_alloc *owner;
 	struct block_alloc_blk *prev;
 	struct block_alloc_blk *next;
-	char data[];
+	/* Links in list of blocks with free slots */
+	struct block_alloc_blk *free_prev;
+	struct block_alloc_blk *free_next;
+	/* Number of free slots */
+	size_t free;
+	/* Summary words then leaf words */
+	size_t bitmap[];
 };
 
 struct block_alloc {
 	/* Start/end of list */
 	struct block_alloc_blk *head;
 	struct block_alloc_blk *tail;
+	/* Blocks with at least one free slot, allocation is served from here */
+	struct block_alloc_blk *free_head;
 	/* Size of one item */
 	size_t item_size;
-	/* Size of block */
+	/* Size (and alignment) of block, a power of two */
 	size_t block_size;
+	/* Items per block */
+	size_t slots;
+	/* Bitmap layout and offset of first item within a block */
+	size_t summary_words;
+	size_t leaf_words;
+	size_t data_offset;
+	/* Number of items allocated and blocks held, and their maxima */
+	size_t items;
+	size_t blocks;
+	size_t peak_items;
+	size_t peak_blocks;
+	/* Sampling hook, NULL if none */
+	block_alloc_hook *hook;
+	void *hook_arg;
+	size_t sample_period;
+	size_t sample_countdown;
 };
 
+/* Blocks of about 64 items */
 void block_alloc_init(struct block_alloc *inst, size_t item_size);
+
+/*
+ * Blocks of block_size bytes (rounded up to a power of two large enough for
+ * one item), e.g. 4096 for page-sized or 2MB for huge-page-sized slabs
+ */
+void block_alloc_init_size(struct block_alloc *inst, size_t item_size, size_t block_size);
 void block_alloc_destroy(struct block_alloc *inst);
 
 void *block_alloc_new(struct block_alloc *inst);
 void block_alloc_delete(struct block_alloc *inst, void *item);
+
+/*
+ * Allocator which owns an item, item may be from any allocator with the same
+ * block size as inst
+ */
+struct block_alloc *block_alloc_owner(const struct block_alloc *inst, const void *item);
+
+/* Fraction of slots in held blocks which are allocated (1 if no blocks) */
+double block_alloc_occupancy(const struct block_alloc *inst);
+
+/* Snapshot of usage, walks every block for the histogram */
+void block_alloc_stats(const struct block_alloc *inst, struct block_alloc_stats *out);
+
+/*
+ * Call hook on every period-th new/delete (1 for all), NULL hook to remove.
+ * Costs a decrement per operation while set.
+ */
+void block_alloc_set_hook(struct block_alloc *inst, block_alloc_hook *hook, void *arg, size_t period);
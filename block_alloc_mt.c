@@ -0,0 +1,425 @@
+#if 0
+(
+set -euo pipefail
+declare -r tmp="$(mktemp)"
+gcc -I./c_modules -Wall -Wextra -Werror -std=c11 -O0 -g -pthread -DTEST_block_alloc_mt -o "$tmp" *.c
+exec valgrind --quiet --leak-check=full --track-origins=yes "$tmp"
+)
+exit 0
+#endif
+#include <cstd/std.h>
+#include "block_alloc_mt.h"
+
+#define DEFAULT_MAGAZINE_SIZE 64
+/* Depot holds at most this many magazines worth of free slots */
+#define DEPOT_MAGAZINES 16
+
+void block_alloc_mt_init(struct block_alloc_mt *inst, size_t item_size, size_t block_size, size_t magazine_size)
+{
+	if (item_size < sizeof(void *)) {
+		item_size = sizeof(void *);
+	}
+	if (magazine_size < 2) {
+		magazine_size = DEFAULT_MAGAZINE_SIZE;
+	}
+	/* Resolve the block size once so all caches share it */
+	struct block_alloc probe;
+	if (block_size) {
+		block_alloc_init_size(&probe, item_size, block_size);
+	} else {
+		block_alloc_init(&probe, item_size);
+	}
+	inst->item_size = item_size;
+	inst->block_size = probe.block_size;
+	inst->magazine_size = magazine_size;
+	mtx_init(&inst->lock, mtx_plain);
+	inst->caches = NULL;
+	buffer_init(&inst->depot, sizeof(void *), 0, magazine_size);
+	inst->depot_max = magazine_size * DEPOT_MAGAZINES;
+}
+
+void block_alloc_mt_destroy(struct block_alloc_mt *inst)
+{
+	struct block_alloc_cache *cache = inst->caches;
+	while (cache) {
+		struct block_alloc_cache *next = cache->next;
+		block_alloc_destroy(&cache->local);
+		free(cache->magazine);
+		free(cache);
+		cache = next;
+	}
+	buffer_destroy(&inst->depot);
+	mtx_destroy(&inst->lock);
+}
+
+static struct block_alloc_cache *home_of(struct block_alloc_cache *cache, void *item)
+{
+	struct block_alloc *owner = block_alloc_owner(&cache->local, item);
+	return (struct block_alloc_cache *) ((char *) owner - offsetof(struct block_alloc_cache, local));
+}
+
+static void remote_push(struct block_alloc_cache *home, void *item)
+{
+	void *head = atomic_load_explicit(&home->remote, memory_order_relaxed);
+	do {
+		*(void **) item = head;
+	} while (!atomic_compare_exchange_weak_explicit(&home->remote, &head, item, memory_order_release, memory_order_relaxed));
+}
+
+/* Return a free slot to the block_alloc which owns it */
+static void release(struct block_alloc_cache *cache, void *item)
+{
+	struct block_alloc_cache *home = home_of(cache, item);
+	if (home == cache) {
+		block_alloc_delete(&cache->local, item);
+	} else {
+		remote_push(home, item);
+	}
+}
+
+/* Move remotely-freed items into the magazine, surplus goes to the blocks */
+static void remote_drain(struct block_alloc_cache *cache)
+{
+	void *item = atomic_exchange_explicit(&cache->remote, NULL, memory_order_acquire);
+	while (item) {
+		void *next = *(void **) item;
+		if (cache->count < cache->pool->magazine_size) {
+			cache->magazine[cache->count++] = item;
+		} else {
+			block_alloc_delete(&cache->local, item);
+		}
+		item = next;
+	}
+}
+
+struct block_alloc_cache *block_alloc_mt_attach(struct block_alloc_mt *inst)
+{
+	mtx_lock(&inst->lock);
+	struct block_alloc_cache *cache = inst->caches;
+	while (cache && cache->attached) {
+		cache = cache->next;
+	}
+	if (cache == NULL) {
+		const size_t size = (sizeof(*cache) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+		cache = aligned_alloc(CACHE_LINE_SIZE, size);
+		if (cache == NULL) {
+			exit(12);
+		}
+		cache->pool = inst;
+		block_alloc_init_size(&cache->local, inst->item_size, inst->block_size);
+		cache->magazine = malloc(inst->magazine_size * sizeof(*cache->magazine));
+		if (cache->magazine == NULL) {
+			exit(12);
+		}
+		cache->count = 0;
+		atomic_init(&cache->remote, NULL);
+		cache->next = inst->caches;
+		inst->caches = cache;
+	}
+	cache->attached = true;
+	mtx_unlock(&inst->lock);
+	return cache;
+}
+
+void block_alloc_mt_detach(struct block_alloc_cache *cache)
+{
+	struct block_alloc_mt *inst = cache->pool;
+	remote_drain(cache);
+	while (cache->count) {
+		release(cache, cache->magazine[--cache->count]);
+	}
+	mtx_lock(&inst->lock);
+	cache->attached = false;
+	mtx_unlock(&inst->lock);
+}
+
+static void refill(struct block_alloc_cache *cache)
+{
+	struct block_alloc_mt *inst = cache->pool;
+	const size_t batch = inst->magazine_size / 2;
+	remote_drain(cache);
+	if (cache->count) {
+		return;
+	}
+	mtx_lock(&inst->lock);
+	size_t n = buffer_size(&inst->depot);
+	if (n > batch) {
+		n = batch;
+	}
+	if (n) {
+		const size_t at = buffer_size(&inst->depot) - n;
+		memcpy(cache->magazine, buffer_cptr(&inst->depot, at), n * sizeof(void *));
+		buffer_erase_range(&inst->depot, at, n);
+		cache->count = n;
+	}
+	mtx_unlock(&inst->lock);
+	while (cache->count < batch) {
+		cache->magazine[cache->count++] = block_alloc_new(&cache->local);
+	}
+}
+
+/* Magazine is full: move a batch to the depot, or back to the blocks */
+static void flush(struct block_alloc_cache *cache)
+{
+	struct block_alloc_mt *inst = cache->pool;
+	const size_t batch = inst->magazine_size / 2;
+	cache->count -= batch;
+	void **items = cache->magazine + cache->count;
+	mtx_lock(&inst->lock);
+	const bool to_depot = buffer_size(&inst->depot) + batch <= inst->depot_max;
+	if (to_depot) {
+		buffer_append_n(&inst->depot, items, batch);
+	}
+	mtx_unlock(&inst->lock);
+	if (!to_depot) {
+		for (size_t i = 0; i < batch; i++) {
+			release(cache, items[i]);
+		}
+	}
+}
+
+void *block_alloc_mt_new(struct block_alloc_cache *cache)
+{
+	if (cache->count == 0) {
+		refill(cache);
+	}
+	return cache->magazine[--cache->count];
+}
+
+void block_alloc_mt_delete(struct block_alloc_cache *cache, void *item)
+{
+	if (item == NULL) {
+		return;
+	}
+	struct block_alloc_cache *home = home_of(cache, item);
+	if (home != cache) {
+		remote_push(home, item);
+		return;
+	}
+	if (cache->count == cache->pool->magazine_size) {
+		flush(cache);
+	}
+	cache->magazine[cache->count++] = item;
+}
+
+#if defined TEST_block_alloc_mt
+#include <time.h>
+#include "spsc_queue.h"
+
+#define MAX_THREADS 64
+#define WORKING_SET 1024
+
+enum mode {
+	MODE_MT,
+	MODE_MUTEX,
+	MODE_MALLOC
+};
+
+struct bench {
+	enum mode mode;
+	size_t threads;
+	size_t ops;
+	struct block_alloc_mt pool;
+	mtx_t lock;
+	struct block_alloc shared;
+	/* queues[i] carries items from thread i to thread i + 1 */
+	struct spsc_queue queues[MAX_THREADS];
+	bool remote;
+	/* Items whose stamp changed while they were held */
+	atomic_size_t errors;
+};
+
+struct worker {
+	struct bench *bench;
+	size_t index;
+	uint64_t rng;
+	uint64_t serial;
+};
+
+/*
+ * Each item is stamped with its holder and a serial when allocated and
+ * checked before it is freed, a slot handed out twice or corrupted while
+ * held (including on its way to another thread) fails the check
+ */
+struct stamp {
+	uint64_t owner;
+	uint64_t serial;
+	uint64_t check[2];
+};
+
+static uint64_t rng(struct worker *w)
+{
+	w->rng ^= w->rng << 13;
+	w->rng ^= w->rng >> 7;
+	w->rng ^= w->rng << 17;
+	return w->rng;
+}
+
+static void *bench_new(struct bench *b, struct block_alloc_cache *cache, size_t owner, uint64_t serial)
+{
+	void *p;
+	switch (b->mode) {
+	case MODE_MT:
+		p = block_alloc_mt_new(cache);
+		break;
+	case MODE_MUTEX:
+		mtx_lock(&b->lock);
+		p = block_alloc_new(&b->shared);
+		mtx_unlock(&b->lock);
+		break;
+	default:
+		p = malloc(32);
+		break;
+	}
+	struct stamp *s = p;
+	s->owner = owner;
+	s->serial = serial;
+	s->check[0] = owner ^ serial;
+	s->check[1] = ~serial;
+	return p;
+}
+
+static void bench_delete(struct bench *b, struct block_alloc_cache *cache, void *p, size_t owner, uint64_t serial)
+{
+	struct stamp *s = p;
+	if (s->owner != owner || s->serial != serial || s->check[0] != (owner ^ serial) || s->check[1] != ~serial) {
+		atomic_fetch_add(&b->errors, 1);
+	}
+	memset(s, 0xff, sizeof(*s));
+	switch (b->mode) {
+	case MODE_MT:
+		block_alloc_mt_delete(cache, p);
+		break;
+	case MODE_MUTEX:
+		mtx_lock(&b->lock);
+		block_alloc_delete(&b->shared, p);
+		mtx_unlock(&b->lock);
+		break;
+	default:
+		free(p);
+		break;
+	}
+}
+
+static int worker(void *arg)
+{
+	struct worker *w = arg;
+	struct bench *b = w->bench;
+	struct block_alloc_cache *cache = b->mode == MODE_MT ? block_alloc_mt_attach(&b->pool) : NULL;
+	void *items[WORKING_SET];
+	uint64_t serials[WORKING_SET];
+	for (size_t i = 0; i < WORKING_SET; i++) {
+		serials[i] = w->serial++;
+		items[i] = bench_new(b, cache, w->index, serials[i]);
+	}
+	if (!b->remote) {
+		/* Replace random items of a private working set */
+		for (size_t i = 0; i < b->ops; i++) {
+			const size_t k = rng(w) % WORKING_SET;
+			bench_delete(b, cache, items[k], w->index, serials[k]);
+			serials[k] = w->serial++;
+			items[k] = bench_new(b, cache, w->index, serials[k]);
+		}
+	} else {
+		/*
+		 * Pass allocations to the next thread, free those from the previous,
+		 * which arrive in the order they were sent
+		 */
+		const size_t from = (w->index + b->threads - 1) % b->threads;
+		struct spsc_queue *out = &b->queues[w->index];
+		struct spsc_queue *in = &b->queues[from];
+		size_t sent = 0;
+		size_t received = 0;
+		void *pending = NULL;
+		while (sent < b->ops || received < b->ops) {
+			bool progress = false;
+			void *p;
+			if (sent < b->ops) {
+				if (pending == NULL) {
+					pending = bench_new(b, cache, w->index, sent);
+				}
+				if (spsc_queue_push(out, &pending)) {
+					pending = NULL;
+					sent++;
+					progress = true;
+				}
+			}
+			while (received < b->ops && spsc_queue_pop(in, &p)) {
+				bench_delete(b, cache, p, from, received);
+				received++;
+				progress = true;
+			}
+			if (!progress) {
+				thrd_yield();
+			}
+		}
+	}
+	for (size_t i = 0; i < WORKING_SET; i++) {
+		bench_delete(b, cache, items[i], w->index, serials[i]);
+	}
+	if (cache) {
+		block_alloc_mt_detach(cache);
+	}
+	return 0;
+}
+
+/* Returns Mops/s, adds items which failed their stamp check to errors */
+static double run(enum mode mode, size_t threads, size_t ops, bool remote, size_t *errors)
+{
+	static struct bench b;
+	struct worker workers[MAX_THREADS];
+	thrd_t handles[MAX_THREADS];
+	struct timespec start;
+	struct timespec end;
+	b.mode = mode;
+	b.threads = threads;
+	b.ops = ops;
+	b.remote = remote;
+	atomic_init(&b.errors, 0);
+	block_alloc_mt_init(&b.pool, 32, 0, 0);
+	mtx_init(&b.lock, mtx_plain);
+	block_alloc_init(&b.shared, 32);
+	for (size_t i = 0; i < threads; i++) {
+		spsc_queue_init(&b.queues[i], sizeof(void *), 256);
+	}
+	timespec_get(&start, TIME_UTC);
+	for (size_t i = 0; i < threads; i++) {
+		/* Working set serials start above those of items sent to other threads */
+		workers[i] = (struct worker) { .bench = &b, .index = i, .rng = 88172645463325252ull + i, .serial = (uint64_t) 1 << 32 };
+		thrd_create(&handles[i], worker, &workers[i]);
+	}
+	for (size_t i = 0; i < threads; i++) {
+		thrd_join(handles[i], NULL);
+	}
+	timespec_get(&end, TIME_UTC);
+	for (size_t i = 0; i < threads; i++) {
+		spsc_queue_destroy(&b.queues[i]);
+	}
+	block_alloc_destroy(&b.shared);
+	mtx_destroy(&b.lock);
+	block_alloc_mt_destroy(&b.pool);
+	*errors += atomic_load(&b.errors);
+	const double t = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+	return threads * ops / t * 1e-6;
+}
+
+int main(int argc, char *argv[])
+{
+	const size_t ops = argc > 1 ? strtoul(argv[1], NULL, 0) : 100000;
+	const size_t max_threads = argc > 2 ? strtoul(argv[2], NULL, 0) : MAX_THREADS;
+
+	for (int remote = 0; remote < 2; remote++) {
+		size_t errors = 0;
+		printf("%s alloc/free throughput (Mops/s)\n", remote ? "Cross-thread" : "Thread-local");
+		for (size_t threads = 1; threads <= max_threads && threads <= MAX_THREADS; threads *= 2) {
+			const double mt = run(MODE_MT, threads, ops, remote, &errors);
+			const double mutex = run(MODE_MUTEX, threads, ops, remote, &errors);
+			const double libc = run(MODE_MALLOC, threads, ops, remote, &errors);
+			printf(" * threads=%-3zu mt %7.1f  mutex %7.1f  malloc %7.1f\n", threads, mt, mutex, libc);
+		}
+		printf(" * Items handed out twice or corrupted: %zu\n", errors);
+		printf("\n");
+	}
+	return 0;
+}
+#endif
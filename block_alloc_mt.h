@@ -0,0 +1,71 @@
+#pragma once
+#include <cstd/std.h>
+#include <stdatomic.h>
+#include <threads.h>
+#include "block_alloc.h"
+#include "buffer.h"
+#include "cache_line.h"
+
+/*
+ * Thread-scalable front end for block_alloc.  Each thread attaches a cache
+ * which owns its own blocks and keeps a magazine of free slots, so the common
+ * path takes no lock.  Items freed by a thread other than the owner of their
+ * block are pushed onto the owner's lock-free remote-free list, which the
+ * owner drains when its magazine runs dry.  Batches of free slots move
+ * between magazines and a mutex-protected global depot.
+ */
+
+struct block_alloc_mt;
+
+struct block_alloc_cache {
+	struct block_alloc_mt *pool;
+	/* Blocks owned by this cache */
+	struct block_alloc local;
+	/* Free slots ready for allocation */
+	void **magazine;
+	size_t count;
+	/* Pool's list of caches */
+	struct block_alloc_cache *next;
+	bool attached;
+	/* Items from this cache's blocks freed by other threads */
+	_Alignas(CACHE_LINE_SIZE) _Atomic(void *) remote;
+};
+
+struct block_alloc_mt {
+	size_t item_size;
+	size_t block_size;
+	/* Magazine capacity, batches are half of this */
+	size_t magazine_size;
+	mtx_t lock;
+	/* All caches, attached or not (under lock) */
+	struct block_alloc_cache *caches;
+	/* Free slots shared between threads (under lock) */
+	struct buffer depot;
+	size_t depot_max;
+};
+
+/*
+ * Item size is rounded up to hold a pointer.  Block size zero uses the
+ * block_alloc default, magazine size zero picks a default.
+ */
+void block_alloc_mt_init(struct block_alloc_mt *inst, size_t item_size, size_t block_size, size_t magazine_size);
+
+/* All caches must be detached, all memory is released */
+void block_alloc_mt_destroy(struct block_alloc_mt *inst);
+
+/*
+ * Get a cache for the calling thread, reusing a detached one if available.
+ * A cache must only be used by one thread at a time.
+ */
+struct block_alloc_cache *block_alloc_mt_attach(struct block_alloc_mt *inst);
+
+/*
+ * Return the magazine to the pool and make the cache available for reuse.
+ * Items remain valid and may be freed through any other cache.
+ */
+void block_alloc_mt_detach(struct block_alloc_cache *cache);
+
+void *block_alloc_mt_new(struct block_alloc_cache *cache);
+
+/* Item may have been allocated through any cache of the same pool */
+void block_alloc_mt_delete(struct block_alloc_cache *cache, void *item);
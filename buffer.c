@@ -1,36 +1,463 @@
+#if 0
+(
+set -euo pipefail
+declare -r tmp="$(mktemp)"
+gcc -I./c_modules -Wall -Wextra -Werror -std=c11 -O0 -g -pthread -DTEST_buffer -o "$tmp" *.c
+exec valgrind --quiet --leak-check=full --track-origins=yes "$tmp"
+)
+exit 0
+#endif
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "buffer.h"
+#include "arena.h"
 
-void buffer_init(struct buffer *inst, size_t item_size, size_t capacity, size_t allocby)
+#define HUGE_PAGE_SIZE ((size_t) 2 << 20)
+
+/* File storage: header occupies the first page-sized block of the file */
+#define FILE_HEADER_SIZE ((size_t) 4096)
+#define FILE_MAGIC "cstrbuf1"
+
+struct file_header {
+	char magic[8];
+	uint64_t item_size;
+	uint64_t length;
+};
+
+static void init_fields(struct buffer *inst, size_t item_size, enum buffer_storage storage)
 {
 	inst->data = NULL;
 	inst->item_size = item_size;
 	inst->length = 0;
 	inst->capacity = 0;
-	inst->allocby = allocby;
+	inst->storage = storage;
+	inst->reserved = 0;
+	inst->fd = -1;
+	inst->alignment = 0;
+	inst->arena = NULL;
+	inst->stats.reallocs = 0;
+	inst->stats.bytes_copied = 0;
+}
+
+void buffer_init(struct buffer *inst, size_t item_size, size_t capacity, size_t allocby)
+{
+	buffer_init_growth(inst, item_size, capacity, BUFFER_GROW_LINEAR, allocby);
+}
+
+void buffer_init_growth(struct buffer *inst, size_t item_size, size_t capacity, enum buffer_growth growth, size_t allocby)
+{
+	init_fields(inst, item_size, BUFFER_STORAGE_HEAP);
+	buffer_set_growth(inst, growth, allocby);
+	buffer_alloc(inst, capacity);
+}
+
+bool buffer_init_aligned(struct buffer *inst, size_t item_size, size_t capacity, size_t allocby, size_t alignment, bool pad_items)
+{
+	if (alignment < _Alignof(max_align_t) || (alignment & (alignment - 1)) != 0) {
+		init_fields(inst, item_size, BUFFER_STORAGE_HEAP);
+		buffer_set_growth(inst, BUFFER_GROW_LINEAR, allocby);
+		errno = EINVAL;
+		return false;
+	}
+	if (pad_items) {
+		item_size = (item_size + alignment - 1) / alignment * alignment;
+	}
+	init_fields(inst, item_size, BUFFER_STORAGE_HEAP);
+	inst->alignment = alignment;
+	buffer_set_growth(inst, BUFFER_GROW_LINEAR, allocby);
+	buffer_alloc(inst, capacity);
+	return true;
+}
+
+void buffer_init_map(struct buffer *inst, size_t item_size, size_t capacity, bool hugetlb)
+{
+	init_fields(inst, item_size, hugetlb ? BUFFER_STORAGE_MAP_HUGETLB : BUFFER_STORAGE_MAP);
+	buffer_set_growth(inst, BUFFER_GROW_2X, 1);
+	buffer_alloc(inst, capacity);
+}
+
+void buffer_init_inline(struct buffer *inst, size_t item_size, void *storage, size_t capacity, size_t allocby)
+{
+	init_fields(inst, item_size, BUFFER_STORAGE_INLINE);
+	buffer_set_growth(inst, BUFFER_GROW_LINEAR, allocby);
+	inst->data = storage;
+	inst->capacity = capacity;
+	inst->reserved = capacity * item_size;
+}
+
+void buffer_init_arena(struct buffer *inst, size_t item_size, size_t capacity, struct arena *arena)
+{
+	init_fields(inst, item_size, BUFFER_STORAGE_ARENA);
+	inst->arena = arena;
+	buffer_set_growth(inst, BUFFER_GROW_2X, 1);
 	buffer_alloc(inst, capacity);
 }
 
-void buffer_alloc(struct buffer *inst, size_t min_capacity)
+static struct file_header *file_header(struct buffer *inst)
+{
+	return (struct file_header *) ((char *) inst->data - FILE_HEADER_SIZE);
+}
+
+bool buffer_open_file(struct buffer *inst, const char *path, size_t item_size)
+{
+	/* Until the mapping succeeds this is an empty heap buffer, safe to destroy */
+	init_fields(inst, item_size, BUFFER_STORAGE_HEAP);
+	buffer_set_growth(inst, BUFFER_GROW_2X, 1);
+	if (item_size == 0) {
+		errno = EINVAL;
+		return false;
+	}
+	const int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		goto fail;
+	}
+	size_t size = st.st_size;
+	const bool created = size == 0;
+	if (created) {
+		size = FILE_HEADER_SIZE;
+		if (ftruncate(fd, size) < 0) {
+			goto fail;
+		}
+	} else if (size < FILE_HEADER_SIZE) {
+		errno = EINVAL;
+		goto fail;
+	}
+	char *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED) {
+		goto fail;
+	}
+	struct file_header *header = (struct file_header *) base;
+	if (created) {
+		memcpy(header->magic, FILE_MAGIC, sizeof(header->magic));
+		header->item_size = item_size;
+		header->length = 0;
+	} else if (memcmp(header->magic, FILE_MAGIC, sizeof(header->magic)) != 0 || header->item_size != item_size) {
+		munmap(base, size);
+		errno = EINVAL;
+		goto fail;
+	}
+	inst->storage = BUFFER_STORAGE_FILE;
+	inst->fd = fd;
+	inst->data = base + FILE_HEADER_SIZE;
+	inst->reserved = size;
+	inst->capacity = (size - FILE_HEADER_SIZE) / item_size;
+	inst->length = header->length <= inst->capacity ? header->length : inst->capacity;
+	return true;
+fail:
+	close(fd);
+	return false;
+}
+
+bool buffer_sync(struct buffer *inst)
+{
+	if (inst->storage != BUFFER_STORAGE_FILE) {
+		return true;
+	}
+	file_header(inst)->length = inst->length;
+	return msync(file_header(inst), inst->reserved, MS_SYNC) == 0;
+}
+
+void buffer_set_growth(struct buffer *inst, enum buffer_growth growth, size_t allocby)
+{
+	inst->growth = growth;
+	inst->allocby = allocby;
+}
+
+/* Capacity to grow to for at least min_capacity items, zero if not permitted */
+static size_t grow_capacity(const struct buffer *inst, size_t min_capacity)
+{
+	const size_t step = inst->allocby ? inst->allocby : 1;
+	size_t capacity = inst->capacity;
+	switch (inst->growth) {
+	case BUFFER_GROW_LINEAR:
+		capacity += step;
+		break;
+	case BUFFER_GROW_1_5X:
+		capacity += capacity / 2;
+		break;
+	case BUFFER_GROW_2X:
+		capacity *= 2;
+		break;
+	case BUFFER_GROW_FIXED:
+		return min_capacity <= inst->allocby ? inst->allocby : 0;
+	}
+	if (capacity < inst->capacity + step) {
+		capacity = inst->capacity + step;
+	}
+	if (capacity < min_capacity) {
+		capacity = min_capacity;
+	}
+	return capacity;
+}
+
+bool buffer_alloc(struct buffer *inst, size_t min_capacity)
 {
 	if (min_capacity <= inst->capacity) {
-		return;
+		return true;
+	}
+	if (inst->growth == BUFFER_GROW_FIXED && min_capacity > inst->allocby) {
+		return false;
 	}
 	buffer_realloc(inst, min_capacity);
+	return true;
+}
+
+bool buffer_reserve(struct buffer *inst, size_t min_capacity)
+{
+	if (min_capacity <= inst->capacity) {
+		return true;
+	}
+	const size_t capacity = grow_capacity(inst, min_capacity);
+	if (capacity == 0) {
+		return false;
+	}
+	buffer_realloc(inst, capacity);
+	return true;
+}
+
+void buffer_shrink_to_fit(struct buffer *inst)
+{
+	if (inst->length < inst->capacity) {
+		buffer_realloc(inst, inst->length);
+	}
+}
+
+static bool over_aligned(const struct buffer *inst)
+{
+	return inst->alignment > _Alignof(max_align_t);
+}
+
+/* Allocate heap storage for capacity items, honouring the alignment */
+static void *heap_alloc(const struct buffer *inst, size_t capacity)
+{
+	size_t bytes = inst->item_size * capacity;
+	void *data;
+	if (over_aligned(inst)) {
+		/* aligned_alloc requires a multiple of the alignment */
+		bytes = (bytes + inst->alignment - 1) / inst->alignment * inst->alignment;
+		data = aligned_alloc(inst->alignment, bytes);
+	} else {
+		data = malloc(bytes);
+	}
+	if (data == NULL) {
+		exit(12);
+	}
+	return data;
+}
+
+static void heap_realloc(struct buffer *inst, size_t capacity)
+{
+	if (capacity == 0) {
+		free(inst->data);
+		inst->data = NULL;
+		return;
+	}
+	if (over_aligned(inst)) {
+		/* realloc does not preserve alignment, so move the data ourselves */
+		void *data = heap_alloc(inst, capacity);
+		if (inst->data != NULL) {
+			/* Keep all of the old capacity as realloc would, not just length */
+			const size_t moved = capacity < inst->capacity ? capacity : inst->capacity;
+			memcpy(data, inst->data, moved * inst->item_size);
+			free(inst->data);
+			inst->stats.reallocs++;
+			inst->stats.bytes_copied += moved * inst->item_size;
+		}
+		inst->data = data;
+		return;
+	}
+	void *data = realloc(inst->data, inst->item_size * capacity);
+	if (data == NULL) {
+		exit(12);
+	}
+	if (inst->data != NULL) {
+		inst->stats.reallocs++;
+		if (data != inst->data) {
+			const size_t moved = capacity < inst->capacity ? capacity : inst->capacity;
+			inst->stats.bytes_copied += moved * inst->item_size;
+		}
+	}
+	inst->data = data;
+}
+
+static void inline_realloc(struct buffer *inst, size_t capacity)
+{
+	if (capacity * inst->item_size <= inst->reserved) {
+		return;
+	}
+	/* Spill to the heap, keeping items beyond length as heap storage does */
+	void *data = heap_alloc(inst, capacity);
+	const size_t moved = capacity < inst->capacity ? capacity : inst->capacity;
+	memcpy(data, inst->data, moved * inst->item_size);
+	inst->stats.reallocs++;
+	inst->stats.bytes_copied += moved * inst->item_size;
+	inst->data = data;
+	inst->storage = BUFFER_STORAGE_HEAP;
+	inst->reserved = 0;
+}
+
+static void arena_storage_realloc(struct buffer *inst, size_t capacity)
+{
+	void *data = arena_realloc(inst->arena, inst->data, inst->capacity * inst->item_size, capacity * inst->item_size);
+	if (inst->data != NULL) {
+		inst->stats.reallocs++;
+		if (data != inst->data) {
+			inst->stats.bytes_copied += inst->capacity * inst->item_size;
+		}
+	}
+	inst->data = data;
+}
+
+static size_t map_granule(const struct buffer *inst)
+{
+	if (inst->storage == BUFFER_STORAGE_MAP_HUGETLB) {
+		return HUGE_PAGE_SIZE;
+	}
+	return (size_t) sysconf(_SC_PAGESIZE);
+}
+
+static void *map_create(struct buffer *inst, size_t bytes)
+{
+	void *data = MAP_FAILED;
+#if defined MAP_HUGETLB
+	if (inst->storage == BUFFER_STORAGE_MAP_HUGETLB) {
+		data = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	}
+#endif
+	if (data == MAP_FAILED) {
+		/* No reserved huge pages, use transparent huge pages instead */
+		inst->storage = BUFFER_STORAGE_MAP;
+		data = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	}
+	return data;
+}
+
+static void *map_grow(struct buffer *inst, size_t bytes)
+{
+#if defined MREMAP_MAYMOVE
+	return mremap(inst->data, inst->reserved, bytes, MREMAP_MAYMOVE);
+#else
+	void *data = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (data != MAP_FAILED) {
+		memcpy(data, inst->data, inst->reserved);
+		munmap(inst->data, inst->reserved);
+		inst->stats.bytes_copied += inst->reserved;
+	}
+	return data;
+#endif
+}
+
+static void map_realloc(struct buffer *inst, size_t capacity)
+{
+	const size_t granule = map_granule(inst);
+	const size_t bytes = (capacity * inst->item_size + granule - 1) / granule * granule;
+	if (bytes <= inst->reserved) {
+		/* Keep the address space for regrowth, only release the pages */
+		if (bytes < inst->reserved) {
+			madvise((char *) inst->data + bytes, inst->reserved - bytes, MADV_DONTNEED);
+		}
+		return;
+	}
+	void *data;
+	if (inst->data == NULL) {
+		data = map_create(inst, bytes);
+	} else {
+		data = map_grow(inst, bytes);
+		inst->stats.reallocs++;
+	}
+	if (data == MAP_FAILED) {
+		exit(12);
+	}
+#if defined MADV_HUGEPAGE
+	if (inst->storage == BUFFER_STORAGE_MAP) {
+		madvise(data, bytes, MADV_HUGEPAGE);
+	}
+#endif
+	inst->data = data;
+	inst->reserved = bytes;
+}
+
+static void file_realloc(struct buffer *inst, size_t capacity)
+{
+	const size_t page = (size_t) sysconf(_SC_PAGESIZE);
+	const size_t bytes = (FILE_HEADER_SIZE + capacity * inst->item_size + page - 1) / page * page;
+	if (bytes == inst->reserved) {
+		return;
+	}
+	void *base = file_header(inst);
+	if (bytes > inst->reserved && ftruncate(inst->fd, bytes) < 0) {
+		exit(12);
+	}
+	base = mremap(base, inst->reserved, bytes, MREMAP_MAYMOVE);
+	if (base == MAP_FAILED) {
+		exit(12);
+	}
+	if (bytes < inst->reserved && ftruncate(inst->fd, bytes) < 0) {
+		exit(12);
+	}
+	inst->stats.reallocs++;
+	inst->data = (char *) base + FILE_HEADER_SIZE;
+	inst->reserved = bytes;
+}
+
+static void file_destroy(struct buffer *inst)
+{
+	buffer_sync(inst);
+	munmap(file_header(inst), inst->reserved);
+	close(inst->fd);
+}
+
+static void map_destroy(struct buffer *inst)
+{
+	if (inst->data != NULL) {
+		munmap(inst->data, inst->reserved);
+	}
 }
 
 void buffer_realloc(struct buffer *inst, size_t capacity)
 {
 	if (inst->length > capacity) {
-		inst->length = inst->capacity;
+		inst->length = capacity;
+	}
+	if (capacity == inst->capacity) {
+		return;
+	}
+	switch (inst->storage) {
+	case BUFFER_STORAGE_HEAP:
+		heap_realloc(inst, capacity);
+		break;
+	case BUFFER_STORAGE_MAP:
+	case BUFFER_STORAGE_MAP_HUGETLB:
+		map_realloc(inst, capacity);
+		break;
+	case BUFFER_STORAGE_INLINE:
+		inline_realloc(inst, capacity);
+		break;
+	case BUFFER_STORAGE_FILE:
+		file_realloc(inst, capacity);
+		break;
+	case BUFFER_STORAGE_ARENA:
+		arena_storage_realloc(inst, capacity);
+		break;
 	}
-	inst->data = realloc(inst->data, inst->item_size * capacity);
 	inst->capacity = capacity;
 }
 
-void buffer_resize(struct buffer *inst, size_t size)
+bool buffer_resize(struct buffer *inst, size_t size)
 {
-	buffer_alloc(inst, size);
+	if (!buffer_alloc(inst, size)) {
+		return false;
+	}
 	inst->length = size;
+	return true;
 }
 
 void *buffer_data(struct buffer *inst)
@@ -61,7 +488,7 @@ void *buffer_get(struct buffer *inst, size_t index)
 	return buffer_ptr(inst, index);
 }
 
-const void *buffer_rget(const struct buffer *inst, size_t index)
+const void *buffer_cget(const struct buffer *inst, size_t index)
 {
 	if (index >= inst->length) {
 		return NULL;
@@ -84,9 +511,29 @@ bool buffer_empty(const struct buffer *inst)
 	return inst->length == 0;
 }
 
+void buffer_stats(const struct buffer *inst, struct buffer_stats *out)
+{
+	*out = inst->stats;
+}
+
 void buffer_destroy(struct buffer *inst)
 {
-	free(inst->data);
+	switch (inst->storage) {
+	case BUFFER_STORAGE_HEAP:
+		free(inst->data);
+		break;
+	case BUFFER_STORAGE_MAP:
+	case BUFFER_STORAGE_MAP_HUGETLB:
+		map_destroy(inst);
+		break;
+	case BUFFER_STORAGE_INLINE:
+		break;
+	case BUFFER_STORAGE_FILE:
+		file_destroy(inst);
+		break;
+	case BUFFER_STORAGE_ARENA:
+		break;
+	}
 }
 
 void *buffer_head(struct buffer *inst)
@@ -127,16 +574,7 @@ const void *buffer_cend(const struct buffer *inst)
 
 void *buffer_push(struct buffer *inst, void *in)
 {
-	size_t i = inst->length;
-	if (i == inst->capacity) {
-		buffer_alloc(inst, i + inst->allocby * inst->item_size);
-	}
-	++inst->length;
-	void *p = buffer_get(inst, i);
-	if (in) {
-		memcpy(p, in, inst->item_size);
-	}
-	return p;
+	return buffer_append_n(inst, in, 1);
 }
 
 bool buffer_pop(struct buffer *inst, void *out)
@@ -150,3 +588,334 @@ bool buffer_pop(struct buffer *inst, void *out)
 	buffer_resize(inst, inst->length - 1);
 	return true;
 }
+
+void *buffer_append_n(struct buffer *inst, const void *in, size_t n)
+{
+	return buffer_insert_n(inst, inst->length, in, n);
+}
+
+void *buffer_insert_n(struct buffer *inst, size_t at, const void *in, size_t n)
+{
+	if (at > inst->length) {
+		return NULL;
+	}
+	/* Items of this buffer may move when it grows, so keep their offset */
+	const uintptr_t base = (uintptr_t) inst->data;
+	const uintptr_t src = (uintptr_t) in;
+	const bool alias = in != NULL && src >= base && src < base + inst->length * inst->item_size;
+	const size_t offset = src - base;
+	if (!buffer_reserve(inst, inst->length + n)) {
+		return NULL;
+	}
+	char *p = buffer_ptr(inst, at);
+	if (at < inst->length) {
+		memmove(buffer_ptr(inst, at + n), p, (inst->length - at) * inst->item_size);
+	}
+	const size_t bytes = n * inst->item_size;
+	if (alias) {
+		/* Source bytes before the insertion point stay, the rest moved up */
+		char *data = inst->data;
+		const size_t split = at * inst->item_size;
+		const size_t before = offset < split ? (split - offset < bytes ? split - offset : bytes) : 0;
+		memcpy(p, data + offset, before);
+		memcpy(p + before, data + offset + before + bytes, bytes - before);
+	} else if (in) {
+		memcpy(p, in, bytes);
+	}
+	inst->length += n;
+	return p;
+}
+
+bool buffer_erase_range(struct buffer *inst, size_t at, size_t n)
+{
+	if (at > inst->length || n > inst->length - at) {
+		return false;
+	}
+	const size_t tail = inst->length - at - n;
+	if (tail) {
+		memmove(buffer_ptr(inst, at), buffer_cptr(inst, at + n), tail * inst->item_size);
+	}
+	inst->length -= n;
+	return true;
+}
+
+void *buffer_splice(struct buffer *dst, size_t at, struct buffer *src, size_t src_at, size_t n)
+{
+	if (dst == src || dst->item_size != src->item_size) {
+		return NULL;
+	}
+	if (src_at > src->length || n > src->length - src_at) {
+		return NULL;
+	}
+	void *p = buffer_insert_n(dst, at, buffer_cptr(src, src_at), n);
+	if (p == NULL) {
+		return NULL;
+	}
+	buffer_erase_range(src, src_at, n);
+	return p;
+}
+
+bool buffer_swap_remove(struct buffer *inst, size_t index, void *out)
+{
+	if (index >= inst->length) {
+		return false;
+	}
+	void *p = buffer_ptr(inst, index);
+	if (out) {
+		memcpy(out, p, inst->item_size);
+	}
+	--inst->length;
+	if (index != inst->length) {
+		memcpy(p, buffer_cptr(inst, inst->length), inst->item_size);
+	}
+	return true;
+}
+
+#if defined TEST_buffer
+static void test_growth(const char *name, enum buffer_growth growth, size_t allocby)
+{
+	struct buffer buf;
+	struct buffer_stats stats;
+	size_t pushed = 0;
+	buffer_init_growth(&buf, sizeof(int), 0, growth, allocby);
+	for (int i = 0; i < 100000; i++) {
+		if (buffer_push(&buf, &i) == NULL) {
+			break;
+		}
+		pushed++;
+	}
+	buffer_stats(&buf, &stats);
+	printf(" * %-8s pushed=%zu capacity=%zu reallocs=%zu copied=%zu\n", name, pushed, buf.capacity, stats.reallocs, stats.bytes_copied);
+	if (growth == BUFFER_GROW_FIXED) {
+		const bool rejected = !buffer_resize(&buf, allocby + 1) && buf.length == pushed && buf.capacity == allocby;
+		printf("   Resize past the cap rejected: %d\n", rejected);
+	}
+	for (size_t i = 0; i < pushed; i++) {
+		if (*(const int *) buffer_cget(&buf, i) != (int) i) {
+			printf("   Mismatch at %zu\n", i);
+		}
+	}
+	buffer_shrink_to_fit(&buf);
+	printf("   Capacity after shrink: %zu\n", buf.capacity);
+	buffer_destroy(&buf);
+}
+
+static void test_map(bool hugetlb)
+{
+	struct buffer buf;
+	struct buffer_stats stats;
+	buffer_init_map(&buf, sizeof(size_t), 0, hugetlb);
+	for (size_t i = 0; i < 1000000; i++) {
+		buffer_push(&buf, &i);
+	}
+	buffer_stats(&buf, &stats);
+	printf(" * hugetlb=%d storage=%d reserved=%zu reallocs=%zu copied=%zu\n", hugetlb, buf.storage, buf.reserved, stats.reallocs, stats.bytes_copied);
+	size_t errors = 0;
+	for (size_t i = 0; i < buf.length; i++) {
+		errors += *(const size_t *) buffer_cget(&buf, i) != i;
+	}
+	buffer_resize(&buf, 1000);
+	buffer_shrink_to_fit(&buf);
+	errors += *(const size_t *) buffer_ctail(&buf) != 999;
+	printf("   Errors: %zu, capacity after shrink: %zu\n", errors, buf.capacity);
+	buffer_destroy(&buf);
+}
+
+static void test_inline(void)
+{
+	struct buffer buf;
+	int storage[16];
+	buffer_init_inline(&buf, sizeof(int), storage, 16, 16);
+	for (int i = 0; i < 16; i++) {
+		buffer_push(&buf, &i);
+	}
+	printf(" * 16 items: on heap=%d\n", buf.data != storage);
+	for (int i = 16; i < 40; i++) {
+		buffer_push(&buf, &i);
+	}
+	size_t errors = 0;
+	for (size_t i = 0; i < buf.length; i++) {
+		errors += *(const int *) buffer_cget(&buf, i) != (int) i;
+	}
+	printf(" * 40 items: on heap=%d, errors=%zu\n", buf.data != storage, errors);
+	buffer_destroy(&buf);
+}
+
+static void print_ints(const char *title, const struct buffer *buf)
+{
+	printf(" * %-12s", title);
+	for (size_t i = 0; i < buf->length; i++) {
+		printf(" %d", *(const int *) buffer_cget(buf, i));
+	}
+	printf("\n");
+}
+
+static void test_ranges(void)
+{
+	const int data[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+	const int more[] = { 100, 101, 102 };
+	struct buffer a;
+	struct buffer b;
+	buffer_init_growth(&a, sizeof(int), 0, BUFFER_GROW_2X, 4);
+	buffer_init_growth(&b, sizeof(int), 0, BUFFER_GROW_2X, 4);
+	buffer_append_n(&a, data, 10);
+	print_ints("append_n", &a);
+	buffer_insert_n(&a, 3, more, 3);
+	print_ints("insert_n", &a);
+	buffer_erase_range(&a, 0, 2);
+	print_ints("erase_range", &a);
+	buffer_swap_remove(&a, 0, NULL);
+	print_ints("swap_remove", &a);
+	buffer_splice(&b, 0, &a, 2, 4);
+	print_ints("splice src", &a);
+	print_ints("splice dst", &b);
+	printf(" * Invalid ranges rejected: %d\n", !buffer_erase_range(&a, 5, 100) && !buffer_insert_n(&a, 100, more, 1));
+	buffer_destroy(&b);
+	buffer_destroy(&a);
+	/* Sources within the buffer itself, growing it each time */
+	buffer_init_growth(&a, sizeof(int), 0, BUFFER_GROW_2X, 4);
+	buffer_append_n(&a, data, 4);
+	buffer_insert_n(&a, 2, buffer_cptr(&a, 1), 3);
+	print_ints("insert self", &a);
+	buffer_shrink_to_fit(&a);
+	buffer_append_n(&a, buffer_cdata(&a), a.length);
+	print_ints("append self", &a);
+	buffer_shrink_to_fit(&a);
+	buffer_push(&a, buffer_ptr(&a, 0));
+	print_ints("push self", &a);
+	buffer_destroy(&a);
+}
+
+static void test_file(void)
+{
+	char path[] = "/tmp/buffer_test_XXXXXX";
+	const int fd = mkstemp(path);
+	if (fd < 0) {
+		printf(" * Cannot create temporary file\n");
+		return;
+	}
+	close(fd);
+	unlink(path);
+	struct buffer buf;
+	if (!buffer_open_file(&buf, path, sizeof(size_t))) {
+		printf(" * Open failed: %s\n", strerror(errno));
+		return;
+	}
+	for (size_t i = 0; i < 100000; i++) {
+		buffer_push(&buf, &i);
+	}
+	buffer_destroy(&buf);
+	if (!buffer_open_file(&buf, path, sizeof(size_t))) {
+		printf(" * Reopen failed: %s\n", strerror(errno));
+		return;
+	}
+	size_t errors = 0;
+	for (size_t i = 0; i < buf.length; i++) {
+		errors += *(const size_t *) buffer_cget(&buf, i) != i;
+	}
+	printf(" * Reloaded %zu items, capacity %zu, errors=%zu\n", buffer_size(&buf), buf.capacity, errors);
+	buffer_resize(&buf, 10);
+	buffer_shrink_to_fit(&buf);
+	buffer_destroy(&buf);
+	struct buffer wrong;
+	printf(" * Reopen with wrong item size rejected: %d\n", !buffer_open_file(&wrong, path, sizeof(int)));
+	buffer_destroy(&wrong);
+	printf(" * Open with zero item size rejected: %d\n", !buffer_open_file(&wrong, path, 0) && errno == EINVAL);
+	buffer_destroy(&wrong);
+	if (buffer_open_file(&buf, path, sizeof(size_t))) {
+		printf(" * Reloaded %zu items after shrink, capacity %zu\n", buffer_size(&buf), buf.capacity);
+		buffer_destroy(&buf);
+	}
+	unlink(path);
+}
+
+static void test_aligned(size_t alignment)
+{
+	struct buffer buf;
+	size_t misaligned = 0;
+	buffer_init_aligned(&buf, 24, 1, 1, alignment, true);
+	for (int i = 0; i < 1000; i++) {
+		misaligned += (uintptr_t) buffer_push(&buf, NULL) % alignment != 0;
+		misaligned += (uintptr_t) buffer_data(&buf) % alignment != 0;
+	}
+	buffer_shrink_to_fit(&buf);
+	misaligned += (uintptr_t) buffer_data(&buf) % alignment != 0;
+	printf(" * alignment=%-4zu item_size=%-4zu misaligned=%zu\n", alignment, buf.item_size, misaligned);
+	buffer_destroy(&buf);
+}
+
+/*
+ * Rings (deque, queues) keep items beyond length, growth must keep all of
+ * the old capacity whatever the storage
+ */
+static void test_keeps_capacity(const char *name, struct buffer *buf)
+{
+	const size_t old = buf->capacity;
+	for (size_t i = 0; i < old; i++) {
+		memset(buffer_ptr(buf, i), (int) i, buf->item_size);
+	}
+	buffer_alloc(buf, old * 4);
+	size_t lost = 0;
+	for (size_t i = 0; i < old; i++) {
+		const unsigned char *p = buffer_ptr(buf, i);
+		lost += p[0] != (unsigned char) i || p[buf->item_size - 1] != (unsigned char) i;
+	}
+	printf(" * %-8s kept %zu items beyond length, lost=%zu\n", name, old, lost);
+	buffer_destroy(buf);
+}
+
+int main(int argc, char *argv[])
+{
+	(void) argc;
+	(void) argv;
+	struct buffer buf;
+
+	printf("Contents beyond length across growth\n");
+	buffer_init(&buf, 24, 16, 1);
+	test_keeps_capacity("heap", &buf);
+	buffer_init_aligned(&buf, 24, 16, 1, 64, false);
+	test_keeps_capacity("aligned", &buf);
+	char inline_storage[16 * 24];
+	buffer_init_inline(&buf, 24, inline_storage, 16, 1);
+	test_keeps_capacity("inline", &buf);
+	printf("\n");
+
+	printf("Growth policies\n");
+	test_growth("linear", BUFFER_GROW_LINEAR, 64);
+	test_growth("1.5x", BUFFER_GROW_1_5X, 16);
+	test_growth("2x", BUFFER_GROW_2X, 16);
+	test_growth("fixed", BUFFER_GROW_FIXED, 1000);
+	printf("\n");
+
+	printf("Mapped storage\n");
+	test_map(false);
+	test_map(true);
+	printf("\n");
+
+	printf("Inline storage\n");
+	test_inline();
+	printf("\n");
+
+	printf("Range operations\n");
+	test_ranges();
+	printf("\n");
+
+	printf("File storage\n");
+	test_file();
+	printf("\n");
+
+	printf("Aligned storage\n");
+	test_aligned(32);
+	test_aligned(64);
+	test_aligned(4096);
+	size_t rejected = 0;
+	const size_t invalid[] = { 0, 1, _Alignof(max_align_t) / 2, 48, 4095 };
+	for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+		rejected += !buffer_init_aligned(&buf, 24, 16, 1, invalid[i], true) && errno == EINVAL;
+		buffer_destroy(&buf);
+	}
+	printf(" * Invalid alignments rejected: %zu of %zu\n", rejected, sizeof(invalid) / sizeof(invalid[0]));
+	printf("\n");
+	return 0;
+}
+#endif
@@ -1,23 +1,133 @@
 #pragma once
 #include <cstd/std.h>
 
+/* How capacity grows when an append runs out of space */
+enum buffer_growth {
+	/* Grow by allocby items at a time */
+	BUFFER_GROW_LINEAR,
+	/* Multiply capacity by 1.5 / 2 (at least allocby items) */
+	BUFFER_GROW_1_5X,
+	BUFFER_GROW_2X,
+	/* Grow straight to allocby items, appends fail once that is full */
+	BUFFER_GROW_FIXED
+};
+
+/* Where the items are stored */
+enum buffer_storage {
+	/* malloc/realloc */
+	BUFFER_STORAGE_HEAP,
+	/* Anonymous mapping, grown in place by mremap, transparent huge pages */
+	BUFFER_STORAGE_MAP,
+	/* As above but backed by MAP_HUGETLB pages */
+	BUFFER_STORAGE_MAP_HUGETLB,
+	/* Caller-provided storage, moves to the heap when outgrown */
+	BUFFER_STORAGE_INLINE,
+	/* Shared mapping of a file, see buffer_open_file */
+	BUFFER_STORAGE_FILE,
+	/* Carved from an arena, see buffer_init_arena */
+	BUFFER_STORAGE_ARENA
+};
+
+struct arena;
+
+struct buffer_stats {
+	/* Number of times the storage was reallocated */
+	size_t reallocs;
+	/* Bytes moved by the allocator when the storage was relocated */
+	size_t bytes_copied;
+};
+
 struct buffer {
 	void *data;
 	size_t item_size;
 	size_t length;
 	size_t capacity;
+	enum buffer_growth growth;
 	size_t allocby;
+	enum buffer_storage storage;
+	/* Bytes of storage reserved (mapped and inline storage only) */
+	size_t reserved;
+	/* Backing file (file storage only) */
+	int fd;
+	/* Alignment of heap storage, zero for malloc's default */
+	size_t alignment;
+	/* Source of storage (arena storage only) */
+	struct arena *arena;
+	struct buffer_stats stats;
 };
 
+/* Linear growth by allocby items */
 void buffer_init(struct buffer *inst, size_t item_size, size_t capacity, size_t allocby);
+void buffer_init_growth(struct buffer *inst, size_t item_size, size_t capacity, enum buffer_growth growth, size_t allocby);
+
+/*
+ * Heap storage aligned to <alignment> bytes (a power of two, e.g. 32 for AVX,
+ * 64 for a cache line or 4096 for a page), kept across growth.  If pad_items
+ * is set, item_size is rounded up to a multiple of the alignment so that
+ * every item is aligned.  Returns false (with errno set to EINVAL) if the
+ * alignment is not a power of two or is below alignof(max_align_t), leaving
+ * an empty heap buffer.
+ */
+bool buffer_init_aligned(struct buffer *inst, size_t item_size, size_t capacity, size_t allocby, size_t alignment, bool pad_items);
+
+/*
+ * For very large buffers: storage is mmap'd and grows without copying,
+ * shrinking returns the pages to the system.  Falls back to transparent huge
+ * pages if hugetlb is requested but no huge pages are reserved.  Grows 2x.
+ */
+void buffer_init_map(struct buffer *inst, size_t item_size, size_t capacity, bool hugetlb);
+
+/*
+ * Use caller-provided storage (e.g. a local array) for the first capacity
+ * items, no allocation happens until the buffer outgrows it.  The storage
+ * must outlive the buffer.
+ */
+void buffer_init_inline(struct buffer *inst, size_t item_size, void *storage, size_t capacity, size_t allocby);
+
+/*
+ * Storage is allocated from an arena and reclaimed with it, buffer_destroy
+ * does nothing.  Growth is in place while the buffer holds the arena's most
+ * recent allocation, otherwise the old storage is abandoned in the arena, so
+ * capacity grows 2x to bound the waste.
+ */
+void buffer_init_arena(struct buffer *inst, size_t item_size, size_t capacity, struct arena *arena);
+
+/*
+ * Back the buffer with a shared mapping of a file, creating it if needed.
+ * Existing contents are available immediately without copying, growth
+ * extends the file.  The length is stored in the file on buffer_sync and
+ * buffer_destroy.  Returns false (with errno set) if the file cannot be
+ * opened, item_size is zero or the file was written with a different item
+ * size, the buffer is then left empty and may still be destroyed.
+ */
+bool buffer_open_file(struct buffer *inst, const char *path, size_t item_size);
 
-/* Only grows buffer */
-void buffer_alloc(struct buffer *inst, size_t min_capacity);
+/* Flush a file-backed buffer to disk, no-op for other storage */
+bool buffer_sync(struct buffer *inst);
 
-/* Will grow or truncate to the requested capacity */
+/* Change growth policy of an existing buffer */
+void buffer_set_growth(struct buffer *inst, enum buffer_growth growth, size_t allocby);
+
+/*
+ * Only grows buffer, to exactly min_capacity.  Returns false if that is past
+ * the cap of a BUFFER_GROW_FIXED buffer.
+ */
+bool buffer_alloc(struct buffer *inst, size_t min_capacity);
+
+/*
+ * Grow according to the growth policy until capacity is at least
+ * min_capacity, returns false if the policy does not permit it
+ */
+bool buffer_reserve(struct buffer *inst, size_t min_capacity);
+
+/* Release unused capacity */
+void buffer_shrink_to_fit(struct buffer *inst);
+
+/* Will grow or truncate to the requested capacity, ignoring the growth policy */
 void buffer_realloc(struct buffer *inst, size_t capacity);
 
-void buffer_resize(struct buffer *inst, size_t size);
+/* Returns false and leaves the buffer unchanged if buffer_alloc fails */
+bool buffer_resize(struct buffer *inst, size_t size);
 
 void *buffer_data(struct buffer *inst);
 const void *buffer_cdata(const struct buffer *inst);
@@ -37,11 +147,40 @@ const void *buffer_chead(const struct buffer *inst);
 const void *buffer_ctail(const struct buffer *inst);
 const void *buffer_cend(const struct buffer *inst);
 
+/* Returns NULL if the growth policy does not permit the buffer to grow */
 void *buffer_push(struct buffer *inst, void *in);
 bool buffer_pop(struct buffer *inst, void *out);
 
+/*
+ * Range operations: capacity is reserved once and items are moved with a
+ * single memcpy/memmove.  Where "in" is NULL the new items are left
+ * uninitialised, otherwise it may also point at items of the same buffer.
+ * Functions returning pointers return the first new item, or NULL if the
+ * range is invalid or the buffer cannot grow.
+ */
+
+/* Append n items */
+void *buffer_append_n(struct buffer *inst, const void *in, size_t n);
+
+/* Insert n items before index <at> */
+void *buffer_insert_n(struct buffer *inst, size_t at, const void *in, size_t n);
+
+/* Remove n items starting at index <at> */
+bool buffer_erase_range(struct buffer *inst, size_t at, size_t n);
+
+/*
+ * Move n items starting at index <src_at> of <src> to before index <at> of
+ * <dst>.  Buffers must be distinct and have the same item size.
+ */
+void *buffer_splice(struct buffer *dst, size_t at, struct buffer *src, size_t src_at, size_t n);
+
+/* Remove item by moving the last item into its place, order is not kept */
+bool buffer_swap_remove(struct buffer *inst, size_t index, void *out);
+
 size_t buffer_size(const struct buffer *inst);
 bool buffer_empty(const struct buffer *inst);
 void buffer_clear(struct buffer *inst);
 
+void buffer_stats(const struct buffer *inst, struct buffer_stats *out);
+
 void buffer_destroy(struct buffer *inst);
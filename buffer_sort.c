@@ -0,0 +1,360 @@
+#if 0
+(
+set -euo pipefail
+declare -r tmp="$(mktemp)"
+gcc -I./c_modules -Wall -Wextra -Werror -std=c11 -O0 -g -pthread -DTEST_buffer_sort -o "$tmp" *.c
+exec valgrind --quiet --leak-check=full --track-origins=yes "$tmp"
+)
+exit 0
+#endif
+#define _GNU_SOURCE
+#include <threads.h>
+#include <unistd.h>
+#include <cstd/std.h>
+#include "buffer_sort.h"
+
+/* Runs of this many items are insertion-sorted before merging */
+#define INSERTION_RUN 16
+/* Don't start threads for less than this many items per thread */
+#define MIN_ITEMS_PER_THREAD 8192
+
+struct sort_context {
+	binary_tree_comparator *cmp;
+	void *arg;
+	size_t size;
+};
+
+static int compare(const struct sort_context *ctx, const void *a, const void *b)
+{
+	return ctx->cmp(a, ctx->size, b, ctx->size, ctx->arg);
+}
+
+/* Stable merge of two sorted runs into out */
+static void merge(const struct sort_context *ctx, const char *a, size_t na, const char *b, size_t nb, char *out)
+{
+	const size_t size = ctx->size;
+	const char *const a_end = a + na * size;
+	const char *const b_end = b + nb * size;
+	while (a < a_end && b < b_end) {
+		if (compare(ctx, b, a) < 0) {
+			memcpy(out, b, size);
+			b += size;
+		} else {
+			memcpy(out, a, size);
+			a += size;
+		}
+		out += size;
+	}
+	memcpy(out, a, a_end - a);
+	out += a_end - a;
+	memcpy(out, b, b_end - b);
+}
+
+static void insertion_sort(const struct sort_context *ctx, char *data, size_t n, char *item)
+{
+	const size_t size = ctx->size;
+	for (size_t i = 1; i < n; i++) {
+		size_t j = i;
+		while (j > 0 && compare(ctx, data + i * size, data + (j - 1) * size) < 0) {
+			j--;
+		}
+		if (j != i) {
+			memcpy(item, data + i * size, size);
+			memmove(data + (j + 1) * size, data + j * size, (i - j) * size);
+			memcpy(data + j * size, item, size);
+		}
+	}
+}
+
+/* Merge adjacent runs of <width> items from src to dst */
+static void merge_pass(const struct sort_context *ctx, const char *src, char *dst, size_t n, size_t width)
+{
+	const size_t size = ctx->size;
+	for (size_t lo = 0; lo < n; lo += 2 * width) {
+		const size_t mid = lo + width < n ? lo + width : n;
+		const size_t hi = lo + 2 * width < n ? lo + 2 * width : n;
+		merge(ctx, src + lo * size, mid - lo, src + mid * size, hi - mid, dst + lo * size);
+	}
+}
+
+/* Bottom-up merge sort, tmp has room for n items, result is left in data */
+static void sort_range(const struct sort_context *ctx, char *data, char *tmp, size_t n)
+{
+	const size_t size = ctx->size;
+	for (size_t lo = 0; lo < n; lo += INSERTION_RUN) {
+		insertion_sort(ctx, data + lo * size, n - lo < INSERTION_RUN ? n - lo : INSERTION_RUN, tmp);
+	}
+	char *src = data;
+	char *dst = tmp;
+	for (size_t width = INSERTION_RUN; width < n; width *= 2) {
+		merge_pass(ctx, src, dst, n, width);
+		char *swap = src;
+		src = dst;
+		dst = swap;
+	}
+	if (src != data) {
+		memcpy(data, src, n * size);
+	}
+}
+
+struct sort_task {
+	const struct sort_context *ctx;
+	char *data;
+	char *tmp;
+	size_t n;
+	/* Merge tasks: sorted runs a (at data) and b (following it) into tmp */
+	size_t na;
+};
+
+static int sort_thread(void *arg)
+{
+	struct sort_task *task = arg;
+	sort_range(task->ctx, task->data, task->tmp, task->n);
+	return 0;
+}
+
+static int merge_thread(void *arg)
+{
+	struct sort_task *task = arg;
+	const size_t size = task->ctx->size;
+	merge(task->ctx, task->data, task->na, task->data + task->na * size, task->n - task->na, task->tmp);
+	return 0;
+}
+
+/* Run fn over tasks, the last on the calling thread, ids has room for count */
+static void run_tasks(thrd_start_t fn, struct sort_task *tasks, thrd_t *ids, size_t count)
+{
+	size_t started = 0;
+	for (; started + 1 < count; started++) {
+		if (thrd_create(&ids[started], fn, &tasks[started]) != thrd_success) {
+			break;
+		}
+	}
+	for (size_t i = started; i < count; i++) {
+		fn(&tasks[i]);
+	}
+	for (size_t i = 0; i < started; i++) {
+		thrd_join(ids[i], NULL);
+	}
+}
+
+void buffer_sort(struct buffer *inst, binary_tree_comparator *cmp, void *arg, size_t threads)
+{
+	const struct sort_context ctx = {
+		.cmp = cmp ? cmp : binary_tree_default_compare,
+		.arg = arg,
+		.size = inst->item_size
+	};
+	const size_t n = inst->length;
+	if (n < 2) {
+		return;
+	}
+	if (threads == 0) {
+		const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? cpus : 1;
+	}
+	while (threads > 1 && n / threads < MIN_ITEMS_PER_THREAD) {
+		threads /= 2;
+	}
+	char *data = buffer_data(inst);
+	char *tmp = malloc(n * ctx.size);
+	if (tmp == NULL) {
+		exit(12);
+	}
+	if (threads <= 1) {
+		sort_range(&ctx, data, tmp, n);
+		free(tmp);
+		return;
+	}
+	/* Sort one chunk per thread, then merge pairs of chunks in parallel */
+	struct sort_task *tasks = malloc(threads * sizeof(*tasks));
+	thrd_t *ids = malloc(threads * sizeof(*ids));
+	if (tasks == NULL || ids == NULL) {
+		exit(12);
+	}
+	const size_t chunk = (n + threads - 1) / threads;
+	size_t count = 0;
+	for (size_t lo = 0; lo < n; lo += chunk, count++) {
+		tasks[count] = (struct sort_task) {
+			.ctx = &ctx,
+			.data = data + lo * ctx.size,
+			.tmp = tmp + lo * ctx.size,
+			.n = n - lo < chunk ? n - lo : chunk
+		};
+	}
+	run_tasks(sort_thread, tasks, ids, count);
+	char *src = data;
+	char *dst = tmp;
+	for (size_t width = chunk; width < n; width *= 2) {
+		count = 0;
+		for (size_t lo = 0; lo < n; lo += 2 * width, count++) {
+			const size_t hi = lo + 2 * width < n ? lo + 2 * width : n;
+			tasks[count] = (struct sort_task) {
+				.ctx = &ctx,
+				.data = src + lo * ctx.size,
+				.tmp = dst + lo * ctx.size,
+				.n = hi - lo,
+				.na = lo + width < n ? width : hi - lo
+			};
+		}
+		run_tasks(merge_thread, tasks, ids, count);
+		char *swap = src;
+		src = dst;
+		dst = swap;
+	}
+	if (src != data) {
+		memcpy(data, src, n * ctx.size);
+	}
+	free(ids);
+	free(tasks);
+	free(tmp);
+}
+
+void buffer_sort_radix(struct buffer *inst, size_t key_offset, size_t key_size, enum buffer_radix_key key)
+{
+	const size_t n = inst->length;
+	const size_t size = inst->item_size;
+	if (n < 2 || key_size == 0) {
+		return;
+	}
+	const uint16_t one = 1;
+	const bool little_endian = *(const uint8_t *) &one;
+	const bool integer = key != BUFFER_RADIX_BYTES;
+	char *src = buffer_data(inst);
+	char *dst = malloc(n * size);
+	if (dst == NULL) {
+		exit(12);
+	}
+	char *const tmp = dst;
+	/* Least significant byte first */
+	for (size_t pass = 0; pass < key_size; pass++) {
+		const size_t byte = key_offset + (integer && little_endian ? pass : key_size - 1 - pass);
+		/* Flip sign bit so negative values order first */
+		const uint8_t flip = key == BUFFER_RADIX_SIGNED && pass == key_size - 1 ? 0x80 : 0;
+		size_t count[256] = { 0 };
+		for (size_t i = 0; i < n; i++) {
+			count[(uint8_t) src[i * size + byte] ^ flip]++;
+		}
+		/* Skip pass if all items share this byte */
+		if (count[(uint8_t) src[byte] ^ flip] == n) {
+			continue;
+		}
+		size_t pos = 0;
+		for (size_t b = 0; b < 256; b++) {
+			const size_t c = count[b];
+			count[b] = pos;
+			pos += c;
+		}
+		for (size_t i = 0; i < n; i++) {
+			const char *item = src + i * size;
+			memcpy(dst + count[(uint8_t) item[byte] ^ flip]++ * size, item, size);
+		}
+		char *swap = src;
+		src = dst;
+		dst = swap;
+	}
+	if (src != buffer_data(inst)) {
+		memcpy(buffer_data(inst), src, n * size);
+	}
+	free(tmp);
+}
+
+#if defined TEST_buffer_sort
+#include <time.h>
+
+struct record {
+	int64_t key;
+	uint64_t seq;
+};
+
+static int compare_record(const void *a, size_t al, const void *b, size_t bl, void *arg)
+{
+	(void) al;
+	(void) bl;
+	(void) arg;
+	const struct record *x = a;
+	const struct record *y = b;
+	return (x->key > y->key) - (x->key < y->key);
+}
+
+static int compare_qsort(const void *a, const void *b)
+{
+	return compare_record(a, 0, b, 0, NULL);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void fill(struct buffer *buf, size_t n, int64_t range)
+{
+	buffer_resize(buf, n);
+	for (size_t i = 0; i < n; i++) {
+		struct record *r = buffer_ptr(buf, i);
+		/* rand() may only give 15 bits, combine enough for the full range */
+		const uint64_t bits = (uint64_t) rand() << 60 ^ (uint64_t) rand() << 45 ^ (uint64_t) rand() << 30 ^ (uint64_t) rand() << 15 ^ (uint64_t) rand();
+		r->key = (int64_t) (bits % range) - range / 2;
+		r->seq = i;
+	}
+}
+
+/* Sorted and stable (equal keys keep their original order) */
+static bool check(struct buffer *buf)
+{
+	for (size_t i = 1; i < buf->length; i++) {
+		const struct record *a = buffer_cptr(buf, i - 1);
+		const struct record *b = buffer_cptr(buf, i);
+		if (a->key > b->key || (a->key == b->key && a->seq > b->seq)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void bench(size_t n, int64_t range, size_t threads)
+{
+	struct buffer buf;
+	double t;
+	buffer_init_growth(&buf, sizeof(struct record), n, BUFFER_GROW_2X, 1);
+	printf(" * n=%zu key range=%lld\n", n, (long long) range);
+
+	fill(&buf, n, range);
+	t = now();
+	qsort(buffer_data(&buf), n, sizeof(struct record), compare_qsort);
+	printf("   qsort          %.3fs\n", now() - t);
+
+	fill(&buf, n, range);
+	t = now();
+	buffer_sort(&buf, compare_record, NULL, 1);
+	printf("   merge 1 thread %.3fs %s\n", now() - t, check(&buf) ? "ok" : "FAIL");
+
+	fill(&buf, n, range);
+	t = now();
+	buffer_sort(&buf, compare_record, NULL, threads);
+	printf("   merge parallel %.3fs %s\n", now() - t, check(&buf) ? "ok" : "FAIL");
+
+	fill(&buf, n, range);
+	t = now();
+	buffer_sort_radix(&buf, offsetof(struct record, key), sizeof(int64_t), BUFFER_RADIX_SIGNED);
+	printf("   radix          %.3fs %s\n", now() - t, check(&buf) ? "ok" : "FAIL");
+
+	buffer_destroy(&buf);
+}
+
+int main(int argc, char *argv[])
+{
+	const size_t max = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+	const size_t threads = argc > 2 ? strtoul(argv[2], NULL, 0) : 0;
+
+	printf("Sorting 16-byte records\n");
+	for (size_t n = 1000; n <= max; n *= 10) {
+		bench(n, 1000, threads);
+		bench(n, INT64_MAX, threads);
+	}
+	printf("\n");
+	return 0;
+}
+#endif
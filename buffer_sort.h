@@ -0,0 +1,26 @@
+#pragma once
+#include <cstd/std.h>
+#include "buffer.h"
+#include "binary_tree.h"
+
+/* Stable sorting of buffer contents */
+
+/* How the radix sort interprets the key bytes */
+enum buffer_radix_key {
+	/* Native-endian integer of 1, 2, 4 or 8 bytes */
+	BUFFER_RADIX_UNSIGNED,
+	BUFFER_RADIX_SIGNED,
+	/* Bytes compared in memcmp order, e.g. big-endian or normalized keys */
+	BUFFER_RADIX_BYTES
+};
+
+/*
+ * Merge sort with the comparator (item size is passed as both lengths),
+ * using up to <threads> threads, zero for one per online CPU.  Each merge
+ * level halves the threads in use and the final merge of the two halves runs
+ * on one thread, so that single pass over all items limits the speedup.
+ */
+void buffer_sort(struct buffer *inst, binary_tree_comparator *cmp, void *arg, size_t threads);
+
+/* LSD radix sort on the key_size bytes at key_offset within each item */
+void buffer_sort_radix(struct buffer *inst, size_t key_offset, size_t key_size, enum buffer_radix_key key);
@@ -0,0 +1,373 @@
+#if 0
+(
+set -euo pipefail
+declare -r tmp="$(mktemp)"
+gcc -I./c_modules -Wall -Wextra -Werror -std=c11 -O0 -g -pthread -DTEST_cache -o "$tmp" *.c
+exec valgrind --quiet --leak-check=full --track-origins=yes "$tmp"
+)
+exit 0
+#endif
+#include <cstd/std.h>
+#include "cache.h"
+
+#define INITIAL_BUCKETS 16
+
+/* FNV-1a */
+static size_t hash_key(const void *key, size_t length)
+{
+	const unsigned char *p = key;
+	uint64_t h = 14695981039346656037ull;
+	for (size_t i = 0; i < length; i++) {
+		h ^= p[i];
+		h *= 1099511628211ull;
+	}
+	return (size_t) (h ^ (h >> 32));
+}
+
+static struct cache_entry *entry_of(struct ilist *link)
+{
+	return ilist_entry(link, struct cache_entry, ring);
+}
+
+static size_t entry_size(const struct cache_entry *entry)
+{
+	return sizeof(*entry) + entry->value_offset + entry->value_length;
+}
+
+static struct cache_entry **bucket(struct cache *inst, size_t hash)
+{
+	return buffer_ptr(&inst->buckets, hash & (inst->buckets.length - 1));
+}
+
+void cache_init(struct cache *inst, enum cache_policy policy, size_t max_entries, size_t max_bytes, binary_tree_destructor *destructor)
+{
+	inst->policy = policy;
+	buffer_init_growth(&inst->buckets, sizeof(struct cache_entry *), INITIAL_BUCKETS, BUFFER_GROW_2X, INITIAL_BUCKETS);
+	buffer_resize(&inst->buckets, INITIAL_BUCKETS);
+	memset(buffer_data(&inst->buckets), 0, INITIAL_BUCKETS * sizeof(struct cache_entry *));
+	inst->ring = NULL;
+	inst->max_entries = max_entries;
+	inst->max_bytes = max_bytes;
+	inst->entries = 0;
+	inst->bytes = 0;
+	inst->destroy = destructor;
+	inst->alloc = NULL;
+	inst->stats.hits = 0;
+	inst->stats.misses = 0;
+	inst->stats.evictions = 0;
+}
+
+void cache_destroy(struct cache *inst)
+{
+	cache_clear(inst);
+	buffer_destroy(&inst->buckets);
+}
+
+void cache_set_allocator(struct cache *inst, const struct allocator *alloc)
+{
+	inst->alloc = alloc;
+}
+
+size_t cache_size(const struct cache *inst)
+{
+	return inst->entries;
+}
+
+size_t cache_bytes(const struct cache *inst)
+{
+	return inst->bytes;
+}
+
+static struct cache_entry **find(struct cache *inst, const void *key, size_t key_length, size_t hash)
+{
+	struct cache_entry **pos = bucket(inst, hash);
+	for (; *pos != NULL; pos = &(*pos)->chain) {
+		const struct cache_entry *entry = *pos;
+		if (entry->hash == hash && entry->key_length == key_length && memcmp(entry->data, key, key_length) == 0) {
+			break;
+		}
+	}
+	return pos;
+}
+
+/* Double the bucket count, relinking entries into their new buckets */
+static void rehash(struct cache *inst)
+{
+	const size_t old = inst->buckets.length;
+	buffer_resize(&inst->buckets, old * 2);
+	struct cache_entry **heads = buffer_data(&inst->buckets);
+	memset(heads + old, 0, old * sizeof(*heads));
+	for (size_t i = 0; i < old; i++) {
+		struct cache_entry *entry = heads[i];
+		heads[i] = NULL;
+		while (entry != NULL) {
+			struct cache_entry *next = entry->chain;
+			struct cache_entry **head = bucket(inst, entry->hash);
+			entry->chain = *head;
+			*head = entry;
+			entry = next;
+		}
+	}
+}
+
+/* Unlink from bucket <pos> and ring, then destroy */
+static void unlink_entry(struct cache *inst, struct cache_entry **pos)
+{
+	struct cache_entry *entry = *pos;
+	*pos = entry->chain;
+	ilist_remove(&inst->ring, &entry->ring);
+	inst->entries--;
+	inst->bytes -= entry_size(entry);
+	if (inst->destroy) {
+		inst->destroy(entry->data + entry->value_offset, entry->value_length);
+	}
+	allocator_delete(inst->alloc, entry, entry_size(entry));
+}
+
+static struct cache_entry *victim(struct cache *inst)
+{
+	if (inst->policy == CACHE_LRU) {
+		return entry_of(inst->ring->prev);
+	}
+	/* Second chance for referenced entries, terminates within one lap */
+	for (;;) {
+		struct cache_entry *entry = entry_of(inst->ring);
+		if (!entry->referenced) {
+			return entry;
+		}
+		entry->referenced = false;
+		inst->ring = inst->ring->next;
+	}
+}
+
+static bool over_capacity(const struct cache *inst)
+{
+	return (inst->max_entries && inst->entries > inst->max_entries) || (inst->max_bytes && inst->bytes > inst->max_bytes);
+}
+
+/* Evict until within capacity, never evicting <keep> */
+static void evict(struct cache *inst, struct cache_entry *keep)
+{
+	while (over_capacity(inst) && inst->entries > 1) {
+		struct cache_entry *entry = victim(inst);
+		if (entry == keep) {
+			/* Only reachable with CLOCK: pass the hand over it */
+			inst->ring = inst->ring->next;
+			entry = victim(inst);
+			if (entry == keep) {
+				break;
+			}
+		}
+		unlink_entry(inst, find(inst, entry->data, entry->key_length, entry->hash));
+		inst->stats.evictions++;
+	}
+}
+
+void *cache_get(struct cache *inst, const void *key, size_t key_length, size_t *value_length)
+{
+	struct cache_entry *entry = *find(inst, key, key_length, hash_key(key, key_length));
+	if (entry == NULL) {
+		inst->stats.misses++;
+		if (value_length != NULL) {
+			*value_length = 0;
+		}
+		return NULL;
+	}
+	inst->stats.hits++;
+	if (inst->policy == CACHE_LRU) {
+		ilist_move_front(&inst->ring, &entry->ring);
+	} else {
+		entry->referenced = true;
+	}
+	if (value_length != NULL) {
+		*value_length = entry->value_length;
+	}
+	return entry->data + entry->value_offset;
+}
+
+void *cache_put(struct cache *inst, const void *key, size_t key_length, const void *value, size_t value_length)
+{
+	const size_t hash = hash_key(key, key_length);
+	struct cache_entry **pos = find(inst, key, key_length, hash);
+	const size_t align = _Alignof(max_align_t);
+	const size_t value_offset = (key_length + align - 1) / align * align;
+	struct cache_entry *entry = allocator_new(inst->alloc, sizeof(*entry) + value_offset + value_length);
+	entry->hash = hash;
+	entry->key_length = key_length;
+	entry->value_length = value_length;
+	entry->value_offset = value_offset;
+	entry->referenced = false;
+	memcpy(entry->data, key, key_length);
+	memcpy(entry->data + value_offset, value, value_length);
+	/* Release the old entry only after copying, value may point into it */
+	if (*pos != NULL) {
+		unlink_entry(inst, pos);
+	} else if (inst->entries >= inst->buckets.length) {
+		rehash(inst);
+	}
+	struct cache_entry **head = bucket(inst, hash);
+	entry->chain = *head;
+	*head = entry;
+	if (inst->policy == CACHE_LRU) {
+		ilist_insert_before(&inst->ring, &entry->ring);
+		inst->ring = &entry->ring;
+	} else {
+		/* Just behind the hand, so it is examined last */
+		ilist_insert_before(&inst->ring, &entry->ring);
+	}
+	inst->entries++;
+	inst->bytes += entry_size(entry);
+	evict(inst, entry);
+	return entry->data + value_offset;
+}
+
+bool cache_remove(struct cache *inst, const void *key, size_t key_length)
+{
+	struct cache_entry **pos = find(inst, key, key_length, hash_key(key, key_length));
+	if (*pos == NULL) {
+		return false;
+	}
+	unlink_entry(inst, pos);
+	return true;
+}
+
+void cache_clear(struct cache *inst)
+{
+	while (inst->ring != NULL) {
+		struct cache_entry *entry = entry_of(inst->ring);
+		unlink_entry(inst, find(inst, entry->data, entry->key_length, entry->hash));
+	}
+}
+
+void cache_stats(const struct cache *inst, struct cache_stats *out)
+{
+	*out = inst->stats;
+}
+
+#if defined TEST_cache
+#include <time.h>
+
+static size_t destroyed;
+
+static void count_destroy(void *data, size_t length)
+{
+	(void) data;
+	(void) length;
+	destroyed++;
+}
+
+static void test_lru(void)
+{
+	struct cache c;
+	destroyed = 0;
+	cache_init(&c, CACHE_LRU, 3, 0, count_destroy);
+	for (int i = 0; i < 3; i++) {
+		cache_put(&c, &i, sizeof(i), &i, sizeof(i));
+	}
+	int k = 0;
+	cache_get(&c, &k, sizeof(k), NULL);
+	k = 3;
+	cache_put(&c, &k, sizeof(k), &k, sizeof(k));
+	/* 1 was least recently used */
+	k = 1;
+	printf("LRU\n");
+	printf(" * Least recently used evicted: %d, size %zu, destroyed %zu\n", cache_get(&c, &k, sizeof(k), NULL) == NULL, cache_size(&c), destroyed);
+	k = 0;
+	int v = 42;
+	cache_put(&c, &k, sizeof(k), &v, sizeof(v));
+	size_t length;
+	const int *got = cache_get(&c, &k, sizeof(k), &length);
+	printf(" * Replaced value: %d, length %zu, destroyed %zu\n", got ? *got : -1, length, destroyed);
+	struct cache_stats stats;
+	cache_stats(&c, &stats);
+	printf(" * Hits %zu, misses %zu, evictions %zu\n", stats.hits, stats.misses, stats.evictions);
+	cache_destroy(&c);
+	printf(" * Destroyed after cache_destroy: %zu\n", destroyed);
+	printf("\n");
+}
+
+static void test_clock(void)
+{
+	struct cache c;
+	destroyed = 0;
+	cache_init(&c, CACHE_CLOCK, 0, 0, count_destroy);
+	/* Byte limit of 4 entries */
+	int k = 0;
+	cache_put(&c, &k, sizeof(k), &k, sizeof(k));
+	c.max_bytes = cache_bytes(&c) * 4;
+	for (k = 1; k < 4; k++) {
+		cache_put(&c, &k, sizeof(k), &k, sizeof(k));
+	}
+	k = 0;
+	cache_get(&c, &k, sizeof(k), NULL);
+	k = 4;
+	cache_put(&c, &k, sizeof(k), &k, sizeof(k));
+	/* 0 was referenced so gets a second chance, 1 goes */
+	k = 0;
+	const bool kept0 = cache_get(&c, &k, sizeof(k), NULL) != NULL;
+	k = 1;
+	const bool kept1 = cache_get(&c, &k, sizeof(k), NULL) != NULL;
+	printf("CLOCK\n");
+	printf(" * Referenced kept: %d, unreferenced kept: %d, size %zu\n", kept0, kept1, cache_size(&c));
+	for (k = 100; k < 10000; k++) {
+		cache_put(&c, &k, sizeof(k), &k, sizeof(k));
+	}
+	const size_t size = cache_size(&c);
+	const bool removed = cache_remove(&c, &(int){ 9999 }, sizeof(int));
+	printf(" * Size after churn %zu, remove newest: %d, size %zu\n", size, removed, cache_size(&c));
+	cache_destroy(&c);
+	printf("\n");
+}
+
+/* Putting a value back from cache_get copies it before the old one goes */
+static void test_reput(void)
+{
+	struct cache c;
+	cache_init(&c, CACHE_LRU, 4, 0, NULL);
+	const int k = 7;
+	const char value[] = "a value longer than the key";
+	cache_put(&c, &k, sizeof(k), value, sizeof(value));
+	size_t length;
+	const char *got = cache_get(&c, &k, sizeof(k), &length);
+	got = cache_put(&c, &k, sizeof(k), got, length);
+	printf("Re-put from cache_get\n");
+	printf(" * Value kept: %d, size %zu\n", strcmp(got, value) == 0, cache_size(&c));
+	printf("\n");
+	cache_destroy(&c);
+}
+
+/* Skewed lookups (a small hot set plus a long tail) with fill on miss */
+static void bench_policy(enum cache_policy policy, size_t capacity, size_t keys, size_t ops)
+{
+	struct cache c;
+	char value[64] = { 0 };
+	cache_init(&c, policy, capacity, 0, NULL);
+	srand(1);
+	clock_t start = clock();
+	for (size_t i = 0; i < ops; i++) {
+		const uint64_t r = rand();
+		const uint64_t key = r % 4 ? r % (keys / 100) : r % keys;
+		if (cache_get(&c, &key, sizeof(key), NULL) == NULL) {
+			cache_put(&c, &key, sizeof(key), value, sizeof(value));
+		}
+	}
+	const double t = (double) (clock() - start) / CLOCKS_PER_SEC;
+	struct cache_stats stats;
+	cache_stats(&c, &stats);
+	printf(" * %-5s %.1f Mops/s, hit rate %.3f, evictions %zu\n", policy == CACHE_LRU ? "LRU" : "CLOCK", ops / t * 1e-6, (double) stats.hits / ops, stats.evictions);
+	cache_destroy(&c);
+}
+
+int main(int argc, char *argv[])
+{
+	const size_t capacity = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000;
+	const size_t ops = argc > 2 ? strtoul(argv[2], NULL, 10) : 2000000;
+	test_lru();
+	test_clock();
+	test_reput();
+	printf("Capacity %zu, %zu keys, %zu lookups\n", capacity, capacity * 10, ops);
+	bench_policy(CACHE_LRU, capacity, capacity * 10, ops);
+	bench_policy(CACHE_CLOCK, capacity, capacity * 10, ops);
+	return 0;
+}
+#endif
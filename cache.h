@@ -0,0 +1,94 @@
+#pragma once
+#include <cstd/std.h>
+#include "allocator.h"
+#include "buffer.h"
+#include "binary_tree.h"
+#include "ilist.h"
+
+/*
+ * Bounded key/value cache: a chained hash table for lookup plus an intrusive
+ * ring of entries for replacement, so each entry is a single allocation
+ * holding its links, key and value.
+ *
+ * LRU moves an entry to the front of the ring on every hit and evicts from
+ * the back.  CLOCK only sets a reference bit on a hit, and the eviction hand
+ * sweeps the ring clearing bits until it finds an unreferenced entry; hits
+ * then do not write to the ring, at the cost of approximate recency.
+ */
+
+enum cache_policy {
+	CACHE_LRU,
+	CACHE_CLOCK
+};
+
+struct cache_entry {
+	/* Recency ring */
+	struct ilist ring;
+	/* Next entry in hash bucket */
+	struct cache_entry *chain;
+	size_t hash;
+	size_t key_length;
+	size_t value_length;
+	/* Offset of value in data (key is at 0) */
+	size_t value_offset;
+	/* CLOCK reference bit */
+	bool referenced;
+	_Alignas(max_align_t) char data[];
+};
+
+struct cache_stats {
+	size_t hits;
+	size_t misses;
+	/* Entries evicted to respect the capacity */
+	size_t evictions;
+};
+
+struct cache {
+	enum cache_policy policy;
+	/* Bucket heads (struct cache_entry *), count is a power of two */
+	struct buffer buckets;
+	/* LRU: most recent entry.  CLOCK: the hand. */
+	struct ilist *ring;
+	/* Capacity, zero for no limit */
+	size_t max_entries;
+	size_t max_bytes;
+	size_t entries;
+	/* Bytes held by entries, including their headers */
+	size_t bytes;
+	/* Called with the value of each entry which is evicted or removed */
+	binary_tree_destructor *destroy;
+	/* Entry allocator, NULL for malloc */
+	const struct allocator *alloc;
+	struct cache_stats stats;
+};
+
+/*
+ * Either limit may be zero for none (but not both).  Byte limits count keys,
+ * values and per-entry overhead.
+ */
+void cache_init(struct cache *inst, enum cache_policy policy, size_t max_entries, size_t max_bytes, binary_tree_destructor *destructor);
+void cache_destroy(struct cache *inst);
+
+/* Allocate entries from alloc (e.g. slab_alloc_allocator), cache must be empty */
+void cache_set_allocator(struct cache *inst, const struct allocator *alloc);
+
+/* Number of entries / bytes held */
+size_t cache_size(const struct cache *inst);
+size_t cache_bytes(const struct cache *inst);
+
+/* Look up value (counting a hit or miss), NULL if absent */
+void *cache_get(struct cache *inst, const void *key, size_t key_length, size_t *value_length);
+
+/*
+ * Insert or replace (destroying the old value), evicting other entries as
+ * needed.  Returns the stored copy of the value.
+ */
+void *cache_put(struct cache *inst, const void *key, size_t key_length, const void *value, size_t value_length);
+
+/* Remove entry if exists */
+bool cache_remove(struct cache *inst, const void *key, size_t key_length);
+
+/* Remove all entries */
+void cache_clear(struct cache *inst);
+
+void cache_stats(const struct cache *inst, struct cache_stats *out);
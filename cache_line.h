@@ -0,0 +1,9 @@
+#pragma once
+
+/*
+ * Alignment used to keep data written by different threads on separate cache
+ * lines, override with -DCACHE_LINE_SIZE=128 for targets with larger lines
+ */
+#if !defined CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
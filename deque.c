@@ -0,0 +1,269 @@
+#if 0
+(
+set -euo pipefail
+declare -r tmp="$(mktemp)"
+gcc -I./c_modules -Wall -Wextra -Werror -std=c11 -O0 -g -pthread -DTEST_deque -o "$tmp" *.c
+exec valgrind --quiet --leak-check=full --track-origins=yes "$tmp"
+)
+exit 0
+#endif
+#include <cstd/std.h>
+#include "deque.h"
+
+static size_t mask(const struct deque *inst, size_t index)
+{
+	return index & (inst->ring.capacity - 1);
+}
+
+static void *slot(struct deque *inst, size_t index)
+{
+	return buffer_ptr(&inst->ring, mask(inst, inst->head + index));
+}
+
+static size_t round_pow2(size_t x)
+{
+	size_t p = 1;
+	while (p < x) {
+		p <<= 1;
+	}
+	return p;
+}
+
+void deque_init(struct deque *inst, size_t item_size, size_t capacity)
+{
+	buffer_init_growth(&inst->ring, item_size, round_pow2(capacity ? capacity : 1), BUFFER_GROW_2X, 1);
+	inst->head = 0;
+	inst->length = 0;
+}
+
+size_t deque_size(const struct deque *inst)
+{
+	return inst->length;
+}
+
+bool deque_empty(const struct deque *inst)
+{
+	return inst->length == 0;
+}
+
+void deque_clear(struct deque *inst)
+{
+	inst->head = 0;
+	inst->length = 0;
+}
+
+static void grow(struct deque *inst)
+{
+	const size_t old = inst->ring.capacity;
+	buffer_realloc(&inst->ring, old * 2);
+	/* Unwrap: move the part that wrapped to the start into the new space */
+	if (inst->head + inst->length > old) {
+		const size_t wrapped = inst->head + inst->length - old;
+		memcpy(buffer_ptr(&inst->ring, old), buffer_cptr(&inst->ring, 0), wrapped * inst->ring.item_size);
+	}
+}
+
+void *deque_push_front(struct deque *inst, const void *in)
+{
+	if (inst->length == inst->ring.capacity) {
+		grow(inst);
+	}
+	inst->head = mask(inst, inst->head - 1);
+	inst->length++;
+	void *p = slot(inst, 0);
+	if (in) {
+		memcpy(p, in, inst->ring.item_size);
+	}
+	return p;
+}
+
+void *deque_push_back(struct deque *inst, const void *in)
+{
+	if (inst->length == inst->ring.capacity) {
+		grow(inst);
+	}
+	void *p = slot(inst, inst->length);
+	inst->length++;
+	if (in) {
+		memcpy(p, in, inst->ring.item_size);
+	}
+	return p;
+}
+
+bool deque_pop_front(struct deque *inst, void *out)
+{
+	if (inst->length == 0) {
+		return false;
+	}
+	if (out) {
+		memcpy(out, slot(inst, 0), inst->ring.item_size);
+	}
+	deque_drop_front(inst, 1);
+	return true;
+}
+
+bool deque_pop_back(struct deque *inst, void *out)
+{
+	if (inst->length == 0) {
+		return false;
+	}
+	if (out) {
+		memcpy(out, slot(inst, inst->length - 1), inst->ring.item_size);
+	}
+	deque_drop_back(inst, 1);
+	return true;
+}
+
+void *deque_get(struct deque *inst, size_t index)
+{
+	if (index >= inst->length) {
+		return NULL;
+	}
+	return slot(inst, index);
+}
+
+void *deque_front(struct deque *inst)
+{
+	return deque_get(inst, 0);
+}
+
+void *deque_back(struct deque *inst)
+{
+	if (inst->length == 0) {
+		return NULL;
+	}
+	return deque_get(inst, inst->length - 1);
+}
+
+size_t deque_segments(struct deque *inst, struct deque_segment seg[2])
+{
+	if (inst->length == 0) {
+		return 0;
+	}
+	const size_t first = inst->ring.capacity - inst->head;
+	seg[0].data = slot(inst, 0);
+	if (inst->length <= first) {
+		seg[0].length = inst->length;
+		return 1;
+	}
+	seg[0].length = first;
+	seg[1].data = buffer_ptr(&inst->ring, 0);
+	seg[1].length = inst->length - first;
+	return 2;
+}
+
+size_t deque_drop_front(struct deque *inst, size_t n)
+{
+	if (n > inst->length) {
+		n = inst->length;
+	}
+	inst->head = mask(inst, inst->head + n);
+	inst->length -= n;
+	return n;
+}
+
+size_t deque_drop_back(struct deque *inst, size_t n)
+{
+	if (n > inst->length) {
+		n = inst->length;
+	}
+	inst->length -= n;
+	return n;
+}
+
+void deque_destroy(struct deque *inst)
+{
+	buffer_destroy(&inst->ring);
+}
+
+#if defined TEST_deque
+#include <time.h>
+
+static void test_order(void)
+{
+	struct deque dq;
+	struct deque_segment seg[2];
+	deque_init(&dq, sizeof(int), 4);
+	for (int i = 0; i < 6; i++) {
+		deque_push_back(&dq, &i);
+		int j = -1 - i;
+		deque_push_front(&dq, &j);
+	}
+	printf(" * Contents:");
+	for (size_t i = 0; i < deque_size(&dq); i++) {
+		printf(" %d", *(const int *) deque_get(&dq, i));
+	}
+	printf("\n");
+	int x;
+	deque_pop_front(&dq, &x);
+	printf(" * Pop front: %d\n", x);
+	deque_pop_back(&dq, &x);
+	printf(" * Pop back: %d\n", x);
+	const size_t n = deque_segments(&dq, seg);
+	printf(" * Segments:");
+	for (size_t s = 0; s < n; s++) {
+		printf(" [");
+		for (size_t i = 0; i < seg[s].length; i++) {
+			printf(" %d", ((const int *) seg[s].data)[i]);
+		}
+		printf(" ]");
+	}
+	printf("\n");
+	deque_destroy(&dq);
+}
+
+/* FIFO work queue of <depth> items, <ops> push+pop pairs */
+static void bench_fifo(size_t depth, size_t ops)
+{
+	clock_t start;
+	size_t sum_deque = 0;
+	size_t sum_buffer = 0;
+
+	struct deque dq;
+	deque_init(&dq, sizeof(size_t), 0);
+	start = clock();
+	for (size_t i = 0; i < depth; i++) {
+		deque_push_back(&dq, &i);
+	}
+	for (size_t i = 0; i < ops; i++) {
+		size_t x;
+		deque_pop_front(&dq, &x);
+		sum_deque += x;
+		deque_push_back(&dq, &i);
+	}
+	const double t_deque = (double) (clock() - start) / CLOCKS_PER_SEC;
+	deque_destroy(&dq);
+
+	struct buffer buf;
+	buffer_init_growth(&buf, sizeof(size_t), 0, BUFFER_GROW_2X, 1);
+	start = clock();
+	for (size_t i = 0; i < depth; i++) {
+		buffer_push(&buf, &i);
+	}
+	for (size_t i = 0; i < ops; i++) {
+		sum_buffer += *(const size_t *) buffer_chead(&buf);
+		buffer_erase_range(&buf, 0, 1);
+		buffer_push(&buf, &i);
+	}
+	const double t_buffer = (double) (clock() - start) / CLOCKS_PER_SEC;
+	buffer_destroy(&buf);
+
+	printf(" * depth=%-6zu ops=%zu: deque %.4fs, buffer+memmove %.4fs%s\n", depth, ops, t_deque, t_buffer, sum_deque == sum_buffer ? "" : " (MISMATCH)");
+}
+
+int main(int argc, char *argv[])
+{
+	const size_t ops = argc > 1 ? strtoul(argv[1], NULL, 0) : 100000;
+
+	printf("Ordering\n");
+	test_order();
+	printf("\n");
+
+	printf("FIFO benchmark\n");
+	bench_fifo(16, ops);
+	bench_fifo(1000, ops);
+	bench_fifo(10000, ops / 10);
+	printf("\n");
+	return 0;
+}
+#endif
@@ -0,0 +1,52 @@
+#pragma once
+#include <cstd/std.h>
+#include "buffer.h"
+
+/*
+ * Circular double-ended queue of fixed-size items.  Storage is a buffer whose
+ * capacity is kept at a power of two and doubles when full.
+ */
+
+struct deque {
+	struct buffer ring;
+	/* Ring index of first item */
+	size_t head;
+	size_t length;
+};
+
+/* Contiguous run of items, see deque_segments */
+struct deque_segment {
+	void *data;
+	size_t length;
+};
+
+void deque_init(struct deque *inst, size_t item_size, size_t capacity);
+
+size_t deque_size(const struct deque *inst);
+bool deque_empty(const struct deque *inst);
+void deque_clear(struct deque *inst);
+
+/* Returns pointer to the new item, which is copied from <in> if non-NULL */
+void *deque_push_front(struct deque *inst, const void *in);
+void *deque_push_back(struct deque *inst, const void *in);
+
+/* Returns false if empty, copies the item to <out> if non-NULL */
+bool deque_pop_front(struct deque *inst, void *out);
+bool deque_pop_back(struct deque *inst, void *out);
+
+/* Performs range-check, returns NULL for out-of-range (index 0 is front) */
+void *deque_get(struct deque *inst, size_t index);
+void *deque_front(struct deque *inst);
+void *deque_back(struct deque *inst);
+
+/*
+ * Contiguous views of the contents in order from the front, for batch
+ * consumption.  Returns the number of segments filled (0-2).
+ */
+size_t deque_segments(struct deque *inst, struct deque_segment seg[2]);
+
+/* Remove up to n items from the front/back, returns number removed */
+size_t deque_drop_front(struct deque *inst, size_t n);
+size_t deque_drop_back(struct deque *inst, size_t n);
+
+void deque_destroy(struct deque *inst);
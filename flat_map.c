@@ -0,0 +1,381 @@
+#if 0
+(
+set -euo pipefail
+declare -r tmp="$(mktemp)"
+gcc -I./c_modules -Wall -Wextra -Werror -std=c11 -O0 -g -pthread -DTEST_flat_map -o "$tmp" *.c
+exec valgrind --quiet --leak-check=full --track-origins=yes "$tmp"
+)
+exit 0
+#endif
+#include <cstd/std.h>
+#include "buffer_sort.h"
+#include "flat_map.h"
+
+/*
+ * Integer key comparators and branchless lower bound: the search narrows the
+ * range by half each step with a conditional move instead of a branch, so
+ * there are no mispredictions and the loop count only depends on size.
+ */
+#define INT_KEY(name, type) \
+static int compare_##name(const void *a, size_t al, const void *b, size_t bl, void *arg) \
+{ \
+	(void) al; \
+	(void) bl; \
+	(void) arg; \
+	type x; \
+	type y; \
+	memcpy(&x, a, sizeof(x)); \
+	memcpy(&y, b, sizeof(y)); \
+	return (x > y) - (x < y); \
+} \
+static size_t lower_bound_##name(const struct buffer *items, const void *key) \
+{ \
+	const char *data = buffer_cdata(items); \
+	const size_t stride = items->item_size; \
+	size_t len = items->length; \
+	size_t base = 0; \
+	type k; \
+	type x; \
+	if (len == 0) { \
+		return 0; \
+	} \
+	memcpy(&k, key, sizeof(k)); \
+	while (len > 1) { \
+		const size_t half = len / 2; \
+		memcpy(&x, data + (base + half) * stride, sizeof(x)); \
+		base = x < k ? base + half : base; \
+		len -= half; \
+	} \
+	memcpy(&x, data + base * stride, sizeof(x)); \
+	return base + (x < k); \
+}
+
+INT_KEY(u32, uint32_t)
+INT_KEY(i32, int32_t)
+INT_KEY(u64, uint64_t)
+INT_KEY(i64, int64_t)
+
+#undef INT_KEY
+
+void flat_map_init(struct flat_map *inst, size_t item_size, binary_tree_comparator *cmp, void *cmparg)
+{
+	buffer_init_growth(&inst->items, item_size, 0, BUFFER_GROW_1_5X, 16);
+	inst->compare = cmp ? cmp : binary_tree_default_compare;
+	inst->cmparg = cmparg;
+	inst->key = FLAT_MAP_KEY_CUSTOM;
+}
+
+bool flat_map_init_int(struct flat_map *inst, size_t item_size, enum flat_map_key key)
+{
+	static binary_tree_comparator *const compare[] = {
+		[FLAT_MAP_KEY_CUSTOM] = NULL,
+		[FLAT_MAP_KEY_U32] = compare_u32,
+		[FLAT_MAP_KEY_I32] = compare_i32,
+		[FLAT_MAP_KEY_U64] = compare_u64,
+		[FLAT_MAP_KEY_I64] = compare_i64
+	};
+	static const size_t width[] = {
+		[FLAT_MAP_KEY_CUSTOM] = 0,
+		[FLAT_MAP_KEY_U32] = sizeof(uint32_t),
+		[FLAT_MAP_KEY_I32] = sizeof(int32_t),
+		[FLAT_MAP_KEY_U64] = sizeof(uint64_t),
+		[FLAT_MAP_KEY_I64] = sizeof(int64_t)
+	};
+	if (item_size < width[key]) {
+		flat_map_init(inst, item_size, NULL, NULL);
+		errno = EINVAL;
+		return false;
+	}
+	flat_map_init(inst, item_size, compare[key], NULL);
+	inst->key = key;
+	return true;
+}
+
+size_t flat_map_size(const struct flat_map *inst)
+{
+	return buffer_size(&inst->items);
+}
+
+bool flat_map_empty(const struct flat_map *inst)
+{
+	return buffer_empty(&inst->items);
+}
+
+void flat_map_clear(struct flat_map *inst)
+{
+	buffer_clear(&inst->items);
+}
+
+static int compare(const struct flat_map *inst, const void *a, const void *b)
+{
+	const size_t size = inst->items.item_size;
+	return inst->compare(a, size, b, size, inst->cmparg);
+}
+
+size_t flat_map_lower_bound(const struct flat_map *inst, const void *key)
+{
+	switch (inst->key) {
+	case FLAT_MAP_KEY_U32:
+		return lower_bound_u32(&inst->items, key);
+	case FLAT_MAP_KEY_I32:
+		return lower_bound_i32(&inst->items, key);
+	case FLAT_MAP_KEY_U64:
+		return lower_bound_u64(&inst->items, key);
+	case FLAT_MAP_KEY_I64:
+		return lower_bound_i64(&inst->items, key);
+	case FLAT_MAP_KEY_CUSTOM:
+		break;
+	}
+	size_t lo = 0;
+	size_t hi = inst->items.length;
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+		if (compare(inst, buffer_cptr(&inst->items, mid), key) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/* Index of record equal to key, or SIZE_MAX */
+static size_t find_index(const struct flat_map *inst, const void *key)
+{
+	const size_t i = flat_map_lower_bound(inst, key);
+	if (i == inst->items.length || compare(inst, buffer_cptr(&inst->items, i), key) != 0) {
+		return SIZE_MAX;
+	}
+	return i;
+}
+
+void *flat_map_insert(struct flat_map *inst, const void *item, bool *isnew)
+{
+	const size_t i = flat_map_lower_bound(inst, item);
+	const bool is_new = i == inst->items.length || compare(inst, buffer_cptr(&inst->items, i), item) != 0;
+	if (isnew) {
+		*isnew = is_new;
+	}
+	if (!is_new) {
+		return buffer_ptr(&inst->items, i);
+	}
+	return buffer_insert_n(&inst->items, i, item, 1);
+}
+
+bool flat_map_remove(struct flat_map *inst, const void *key)
+{
+	const size_t i = find_index(inst, key);
+	if (i == SIZE_MAX) {
+		return false;
+	}
+	return flat_map_erase(inst, i);
+}
+
+bool flat_map_erase(struct flat_map *inst, size_t index)
+{
+	return buffer_erase_range(&inst->items, index, 1);
+}
+
+void *flat_map_find(struct flat_map *inst, const void *key)
+{
+	const size_t i = find_index(inst, key);
+	if (i == SIZE_MAX) {
+		return NULL;
+	}
+	return buffer_ptr(&inst->items, i);
+}
+
+const void *flat_map_cfind(const struct flat_map *inst, const void *key)
+{
+	return flat_map_find((struct flat_map *) inst, key);
+}
+
+void *flat_map_at(struct flat_map *inst, size_t index)
+{
+	return buffer_get(&inst->items, index);
+}
+
+void *flat_map_each(struct flat_map *inst, flat_map_iterate_callback *iter, void *arg)
+{
+	for (size_t i = 0; i < inst->items.length; i++) {
+		void *res = iter(arg, buffer_ptr(&inst->items, i));
+		if (res) {
+			return res;
+		}
+	}
+	return NULL;
+}
+
+void flat_map_bulk_begin(struct flat_map *inst, size_t expected)
+{
+	buffer_reserve(&inst->items, inst->items.length + expected);
+}
+
+void *flat_map_bulk_add(struct flat_map *inst, const void *item)
+{
+	return buffer_append_n(&inst->items, item, 1);
+}
+
+void flat_map_bulk_end(struct flat_map *inst)
+{
+	/* Stable so the first-added duplicate sorts first, single-threaded */
+	buffer_sort(&inst->items, inst->compare, inst->cmparg, 1);
+	/* Remove duplicates, keeping the first-added of each */
+	const size_t size = inst->items.item_size;
+	char *data = buffer_data(&inst->items);
+	size_t out = 0;
+	for (size_t i = 0; i < inst->items.length; i++) {
+		if (out > 0 && compare(inst, data + (out - 1) * size, data + i * size) == 0) {
+			continue;
+		}
+		if (out != i) {
+			memcpy(data + out * size, data + i * size, size);
+		}
+		out++;
+	}
+	inst->items.length = out;
+}
+
+void flat_map_destroy(struct flat_map *inst)
+{
+	buffer_destroy(&inst->items);
+}
+
+#if defined TEST_flat_map
+#include <time.h>
+
+struct record {
+	uint64_t key;
+	uint64_t value;
+};
+
+static int compare_record(const void *a, size_t al, const void *b, size_t bl, void *arg)
+{
+	(void) al;
+	(void) bl;
+	(void) arg;
+	const struct record *x = a;
+	const struct record *y = b;
+	return (x->key > y->key) - (x->key < y->key);
+}
+
+static uint64_t key_at(struct flat_map *map, size_t index)
+{
+	return ((struct record *) flat_map_at(map, index))->key;
+}
+
+static void test_ops(const char *name, struct flat_map *map)
+{
+	bool isnew;
+	struct record probe = { 0, 0 };
+	printf("Operations (%s)\n", name);
+	printf(" * Empty map: lower_bound=%zu found=%d\n", flat_map_lower_bound(map, &probe), flat_map_find(map, &probe) != NULL);
+	for (uint64_t k = 10; k <= 50; k += 10) {
+		struct record r = { k, k * 100 };
+		flat_map_insert(map, &r, &isnew);
+	}
+	/* Conflict returns the existing record, which may then be updated */
+	struct record dup = { 30, 1 };
+	struct record *existing = flat_map_insert(map, &dup, &isnew);
+	printf(" * Insert conflict: new=%d value=%llu size=%zu\n", isnew, (unsigned long long) existing->value, flat_map_size(map));
+	existing->value = 1;
+	probe.key = 30;
+	printf(" * Updated value: %llu\n", (unsigned long long) ((struct record *) flat_map_find(map, &probe))->value);
+
+	printf(" * lower_bound of 5 10 35 50 51:");
+	const uint64_t probes[] = { 5, 10, 35, 50, 51 };
+	for (size_t i = 0; i < sizeof(probes) / sizeof(probes[0]); i++) {
+		probe.key = probes[i];
+		printf(" %zu", flat_map_lower_bound(map, &probe));
+	}
+	printf(", past the end: %d\n", flat_map_at(map, 5) == NULL);
+
+	probe.key = 10;
+	const bool removed = flat_map_remove(map, &probe);
+	printf(" * Remove 10: %d, again: %d, first key now %llu\n", removed, flat_map_remove(map, &probe), (unsigned long long) key_at(map, 0));
+	const bool erased = flat_map_erase(map, flat_map_size(map) - 1);
+	printf(" * Erase last: %d, out of range: %d, size %zu\n", erased, flat_map_erase(map, 10), flat_map_size(map));
+
+	/* Bulk load in reverse with duplicates, the first-added should win */
+	flat_map_clear(map);
+	flat_map_bulk_begin(map, 200);
+	for (uint64_t i = 0; i < 200; i++) {
+		struct record r = { (199 - i) / 2, i };
+		flat_map_bulk_add(map, &r);
+	}
+	flat_map_bulk_end(map);
+	size_t errors = 0;
+	for (size_t i = 0; i < flat_map_size(map); i++) {
+		const struct record *r = flat_map_at(map, i);
+		errors += r->key != i || r->value != 198 - 2 * i;
+	}
+	printf(" * Bulk load of 200 with duplicates: size %zu, errors=%zu\n", flat_map_size(map), errors);
+	printf("\n");
+}
+
+/* Random lookups (half hits) in maps of n records */
+static void bench_lookup(size_t n, size_t lookups)
+{
+	struct flat_map by_int;
+	struct flat_map by_cmp;
+	struct binary_tree tree;
+	flat_map_init_int(&by_int, sizeof(struct record), FLAT_MAP_KEY_U64);
+	flat_map_init(&by_cmp, sizeof(struct record), compare_record, NULL);
+	binary_tree_init(&tree, compare_record, NULL, NULL);
+	flat_map_bulk_begin(&by_int, n);
+	flat_map_bulk_begin(&by_cmp, n);
+	for (size_t i = 0; i < n; i++) {
+		struct record r = { rand() % (2 * n), i };
+		flat_map_bulk_add(&by_int, &r);
+		flat_map_bulk_add(&by_cmp, &r);
+		binary_tree_insert_new(&tree, &r, sizeof(r));
+	}
+	flat_map_bulk_end(&by_int);
+	flat_map_bulk_end(&by_cmp);
+
+	size_t found[3] = { 0, 0, 0 };
+	double t[3];
+	for (int kind = 0; kind < 3; kind++) {
+		srand(1);
+		clock_t start = clock();
+		for (size_t i = 0; i < lookups; i++) {
+			struct record probe = { rand() % (2 * n), 0 };
+			const void *hit;
+			if (kind == 0) {
+				hit = flat_map_cfind(&by_int, &probe);
+			} else if (kind == 1) {
+				hit = flat_map_cfind(&by_cmp, &probe);
+			} else {
+				hit = binary_tree_cget(&tree, &probe, sizeof(probe), NULL);
+			}
+			found[kind] += hit != NULL;
+		}
+		t[kind] = (double) (clock() - start) / CLOCKS_PER_SEC;
+	}
+	printf("%zu lookups in %zu records%s\n", lookups, flat_map_size(&by_int), found[0] == found[1] && found[1] == found[2] ? "" : " (RESULTS DIFFER)");
+	printf(" * flat_map (u64 key):    %.3fs\n", t[0]);
+	printf(" * flat_map (comparator): %.3fs\n", t[1]);
+	printf(" * binary_tree:           %.3fs\n", t[2]);
+	flat_map_destroy(&by_int);
+	flat_map_destroy(&by_cmp);
+	binary_tree_destroy(&tree);
+}
+
+int main(int argc, char *argv[])
+{
+	const size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+	const size_t lookups = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000;
+	struct flat_map map;
+	flat_map_init_int(&map, sizeof(struct record), FLAT_MAP_KEY_U64);
+	test_ops("u64 key", &map);
+	flat_map_destroy(&map);
+	flat_map_init(&map, sizeof(struct record), compare_record, NULL);
+	test_ops("comparator", &map);
+	flat_map_destroy(&map);
+	printf("Records smaller than the integer key rejected: %d\n", !flat_map_init_int(&map, sizeof(uint32_t), FLAT_MAP_KEY_U64) && errno == EINVAL);
+	flat_map_destroy(&map);
+	printf("\n");
+	bench_lookup(n, lookups);
+	return 0;
+}
+#endif
@@ -0,0 +1,78 @@
+#pragma once
+#include <cstd/std.h>
+#include "buffer.h"
+#include "binary_tree.h"
+
+/*
+ * Sorted array of fixed-size records, for small or read-mostly ordered sets.
+ * Keys are compared with a binary_tree_comparator which is passed whole
+ * records (the item size is passed as both lengths), so lookups take a
+ * record whose key part is filled in.
+ *
+ * Do not edit the key of a record within the map.
+ */
+
+/* Fixed-width integer key at the start of each record, for fast lookups */
+enum flat_map_key {
+	FLAT_MAP_KEY_CUSTOM,
+	FLAT_MAP_KEY_U32,
+	FLAT_MAP_KEY_I32,
+	FLAT_MAP_KEY_U64,
+	FLAT_MAP_KEY_I64
+};
+
+typedef void *flat_map_iterate_callback(void *arg, void *item);
+
+struct flat_map {
+	struct buffer items;
+	binary_tree_comparator *compare;
+	void *cmparg;
+	enum flat_map_key key;
+};
+
+/* Comparator and argument as for binary_tree_init */
+void flat_map_init(struct flat_map *inst, size_t item_size, binary_tree_comparator *cmp, void *cmparg);
+
+/*
+ * Records start with an integer key of the given type.  Returns false (with
+ * errno set to EINVAL) if item_size is smaller than the key, leaving an empty
+ * map which may still be destroyed.
+ */
+bool flat_map_init_int(struct flat_map *inst, size_t item_size, enum flat_map_key key);
+
+size_t flat_map_size(const struct flat_map *inst);
+bool flat_map_empty(const struct flat_map *inst);
+void flat_map_clear(struct flat_map *inst);
+
+/* Insert record, return existing record (without modifying) on conflict */
+void *flat_map_insert(struct flat_map *inst, const void *item, bool *isnew);
+
+/* Remove record if exists */
+bool flat_map_remove(struct flat_map *inst, const void *key);
+
+/* Remove record at index */
+bool flat_map_erase(struct flat_map *inst, size_t index);
+
+/* Find record, NULL if not found */
+void *flat_map_find(struct flat_map *inst, const void *key);
+const void *flat_map_cfind(const struct flat_map *inst, const void *key);
+
+/* Index of first record not less than key (flat_map_size if none) */
+size_t flat_map_lower_bound(const struct flat_map *inst, const void *key);
+
+/* Record at index in key order, NULL for out-of-range */
+void *flat_map_at(struct flat_map *inst, size_t index);
+
+/* Iterate in key order, stops early and returns result if callback returns non-NULL */
+void *flat_map_each(struct flat_map *inst, flat_map_iterate_callback *iter, void *arg);
+
+/*
+ * Bulk loading: records are appended unsorted and sorted once by
+ * flat_map_bulk_end (duplicates keep the first-added record).  No lookups
+ * between begin and end.
+ */
+void flat_map_bulk_begin(struct flat_map *inst, size_t expected);
+void *flat_map_bulk_add(struct flat_map *inst, const void *item);
+void flat_map_bulk_end(struct flat_map *inst);
+
+void flat_map_destroy(struct flat_map *inst);
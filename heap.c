@@ -0,0 +1,394 @@
+#if 0
+(
+set -euo pipefail
+declare -r tmp="$(mktemp)"
+gcc -I./c_modules -Wall -Wextra -Werror -std=c11 -O0 -g -pthread -DTEST_heap -o "$tmp" *.c
+exec valgrind --quiet --leak-check=full --track-origins=yes "$tmp"
+)
+exit 0
+#endif
+#include <cstd/std.h>
+#include "heap.h"
+
+void heap_init(struct heap *inst, size_t item_size, size_t arity, binary_tree_comparator *cmp, void *cmparg)
+{
+	const size_t align = sizeof(size_t);
+	inst->item_size = item_size;
+	inst->item_offset = sizeof(heap_handle);
+	const size_t slot_size = (inst->item_offset + item_size + align - 1) / align * align;
+	buffer_init_growth(&inst->slots, slot_size, 0, BUFFER_GROW_2X, 16);
+	buffer_init_growth(&inst->index, sizeof(size_t), 0, BUFFER_GROW_2X, 16);
+	buffer_init_growth(&inst->free_handles, sizeof(heap_handle), 0, BUFFER_GROW_2X, 16);
+	inst->arity = arity >= 2 ? arity : HEAP_DEFAULT_ARITY;
+	inst->compare = cmp ? cmp : binary_tree_default_compare;
+	inst->cmparg = cmparg;
+	inst->scratch = malloc(slot_size);
+	if (inst->scratch == NULL) {
+		exit(12);
+	}
+}
+
+void heap_destroy(struct heap *inst)
+{
+	buffer_destroy(&inst->slots);
+	buffer_destroy(&inst->index);
+	buffer_destroy(&inst->free_handles);
+	free(inst->scratch);
+}
+
+size_t heap_size(const struct heap *inst)
+{
+	return inst->slots.length;
+}
+
+bool heap_empty(const struct heap *inst)
+{
+	return inst->slots.length == 0;
+}
+
+void heap_clear(struct heap *inst)
+{
+	buffer_clear(&inst->slots);
+	buffer_clear(&inst->index);
+	buffer_clear(&inst->free_handles);
+}
+
+static char *slot(struct heap *inst, size_t i)
+{
+	return buffer_ptr(&inst->slots, i);
+}
+
+static size_t *index_of(struct heap *inst, heap_handle handle)
+{
+	return buffer_ptr(&inst->index, handle);
+}
+
+static bool less(struct heap *inst, const char *a, const char *b)
+{
+	return inst->compare(a + inst->item_offset, inst->item_size, b + inst->item_offset, inst->item_size, inst->cmparg) < 0;
+}
+
+/* Store slot contents at position i and record its position */
+static void place(struct heap *inst, size_t i, const char *from)
+{
+	memcpy(slot(inst, i), from, inst->slots.item_size);
+	*index_of(inst, *(const heap_handle *) from) = i;
+}
+
+/* Sifting moves a hole rather than swapping, the moving slot waits in scratch */
+
+static size_t sift_up(struct heap *inst, size_t i)
+{
+	char *moving = inst->scratch;
+	memcpy(moving, slot(inst, i), inst->slots.item_size);
+	while (i > 0) {
+		const size_t parent = (i - 1) / inst->arity;
+		if (!less(inst, moving, slot(inst, parent))) {
+			break;
+		}
+		place(inst, i, slot(inst, parent));
+		i = parent;
+	}
+	place(inst, i, moving);
+	return i;
+}
+
+static void sift_down(struct heap *inst, size_t i)
+{
+	const size_t n = inst->slots.length;
+	char *moving = inst->scratch;
+	memcpy(moving, slot(inst, i), inst->slots.item_size);
+	for (;;) {
+		const size_t first = i * inst->arity + 1;
+		if (first >= n) {
+			break;
+		}
+		const size_t end = n - first < inst->arity ? n : first + inst->arity;
+		size_t min = first;
+		for (size_t c = first + 1; c < end; c++) {
+			if (less(inst, slot(inst, c), slot(inst, min))) {
+				min = c;
+			}
+		}
+		if (!less(inst, slot(inst, min), moving)) {
+			break;
+		}
+		place(inst, i, slot(inst, min));
+		i = min;
+	}
+	place(inst, i, moving);
+}
+
+static heap_handle handle_alloc(struct heap *inst)
+{
+	heap_handle handle;
+	if (buffer_pop(&inst->free_handles, &handle)) {
+		return handle;
+	}
+	handle = inst->index.length;
+	size_t none = HEAP_NO_HANDLE;
+	buffer_push(&inst->index, &none);
+	return handle;
+}
+
+static void handle_free(struct heap *inst, heap_handle handle)
+{
+	*index_of(inst, handle) = HEAP_NO_HANDLE;
+	buffer_push(&inst->free_handles, &handle);
+}
+
+heap_handle heap_push(struct heap *inst, const void *item)
+{
+	const heap_handle handle = handle_alloc(inst);
+	char *s = buffer_push(&inst->slots, NULL);
+	memcpy(s, &handle, sizeof(handle));
+	memcpy(s + inst->item_offset, item, inst->item_size);
+	sift_up(inst, inst->slots.length - 1);
+	return handle;
+}
+
+const void *heap_peek(const struct heap *inst)
+{
+	if (inst->slots.length == 0) {
+		return NULL;
+	}
+	return (const char *) buffer_cptr(&inst->slots, 0) + inst->item_offset;
+}
+
+/* Remove the slot at position i, filling it with the last slot */
+static void remove_at(struct heap *inst, size_t i, void *out)
+{
+	char *s = slot(inst, i);
+	if (out != NULL) {
+		memcpy(out, s + inst->item_offset, inst->item_size);
+	}
+	handle_free(inst, *(heap_handle *) s);
+	const size_t last = inst->slots.length - 1;
+	if (i != last) {
+		place(inst, i, slot(inst, last));
+	}
+	inst->slots.length--;
+	if (i != last) {
+		if (sift_up(inst, i) == i) {
+			sift_down(inst, i);
+		}
+	}
+}
+
+bool heap_pop_min(struct heap *inst, void *out)
+{
+	if (inst->slots.length == 0) {
+		return false;
+	}
+	remove_at(inst, 0, out);
+	return true;
+}
+
+void heap_heapify(struct heap *inst, const void *items, size_t n)
+{
+	heap_clear(inst);
+	buffer_resize(&inst->slots, n);
+	buffer_resize(&inst->index, n);
+	const char *in = items;
+	for (size_t i = 0; i < n; i++, in += inst->item_size) {
+		char *s = slot(inst, i);
+		memcpy(s, &i, sizeof(heap_handle));
+		memcpy(s + inst->item_offset, in, inst->item_size);
+		*index_of(inst, i) = i;
+	}
+	/* Floyd: sift down every parent, last first */
+	if (n > 1) {
+		for (size_t i = (n - 2) / inst->arity + 1; i-- > 0; ) {
+			sift_down(inst, i);
+		}
+	}
+}
+
+static bool handle_valid(const struct heap *inst, heap_handle handle)
+{
+	return handle < inst->index.length && *(const size_t *) buffer_cptr(&inst->index, handle) != HEAP_NO_HANDLE;
+}
+
+const void *heap_get(const struct heap *inst, heap_handle handle)
+{
+	if (!handle_valid(inst, handle)) {
+		return NULL;
+	}
+	const size_t i = *(const size_t *) buffer_cptr(&inst->index, handle);
+	return (const char *) buffer_cptr(&inst->slots, i) + inst->item_offset;
+}
+
+void heap_decrease_key(struct heap *inst, heap_handle handle, const void *item)
+{
+	if (!handle_valid(inst, handle)) {
+		return;
+	}
+	const size_t i = *index_of(inst, handle);
+	memcpy(slot(inst, i) + inst->item_offset, item, inst->item_size);
+	if (sift_up(inst, i) == i) {
+		sift_down(inst, i);
+	}
+}
+
+bool heap_remove(struct heap *inst, heap_handle handle, void *out)
+{
+	if (!handle_valid(inst, handle)) {
+		return false;
+	}
+	remove_at(inst, *index_of(inst, handle), out);
+	return true;
+}
+
+#if defined TEST_heap
+#include <time.h>
+
+struct timer {
+	uint64_t deadline;
+	uint64_t id;
+};
+
+static int timer_compare(const void *a, size_t al, const void *b, size_t bl, void *arg)
+{
+	(void) al;
+	(void) bl;
+	(void) arg;
+	const struct timer *x = a;
+	const struct timer *y = b;
+	if (x->deadline != y->deadline) {
+		return x->deadline < y->deadline ? -1 : 1;
+	}
+	return x->id < y->id ? -1 : x->id > y->id;
+}
+
+/* Pop everything, returns the number of items out of order */
+static size_t drain_sorted(struct heap *h, size_t *count)
+{
+	struct timer prev = { 0, 0 };
+	struct timer t;
+	size_t errors = 0;
+	*count = 0;
+	while (heap_pop_min(h, &t)) {
+		errors += *count > 0 && timer_compare(&prev, 0, &t, 0, NULL) > 0;
+		prev = t;
+		(*count)++;
+	}
+	return errors;
+}
+
+static void test_ops(size_t arity)
+{
+	struct heap h;
+	const size_t n = 10000;
+	size_t count;
+	heap_handle *handles = malloc(n * sizeof(*handles));
+	heap_init(&h, sizeof(struct timer), arity, timer_compare, NULL);
+	for (size_t i = 0; i < n; i++) {
+		struct timer t = { rand() % 100000, i };
+		handles[i] = heap_push(&h, &t);
+	}
+	/* Change a third of the keys, remove a third */
+	size_t removed = 0;
+	size_t errors = 0;
+	for (size_t i = 0; i < n; i += 3) {
+		struct timer t = *(const struct timer *) heap_get(&h, handles[i]);
+		t.deadline = rand() % 100000;
+		heap_decrease_key(&h, handles[i], &t);
+		const struct timer *changed = heap_get(&h, handles[i]);
+		errors += changed == NULL || changed->deadline != t.deadline;
+		if (i + 1 < n) {
+			struct timer out;
+			errors += !heap_remove(&h, handles[i + 1], &out) || out.id != i + 1;
+			removed++;
+		}
+	}
+	printf("Arity %zu\n", arity);
+	printf(" * Key changes and removals by handle: errors=%zu\n", errors);
+	printf(" * Stale handle rejected: %d\n", heap_get(&h, handles[1]) == NULL && !heap_remove(&h, handles[1], NULL));
+	errors = drain_sorted(&h, &count);
+	printf(" * Popped %zu of %zu, out of order=%zu\n", count, n - removed, errors);
+
+	struct timer *array = malloc(n * sizeof(*array));
+	for (size_t i = 0; i < n; i++) {
+		array[i].deadline = rand() % 1000;
+		array[i].id = i;
+	}
+	heap_heapify(&h, array, n);
+	printf(" * Heapify keeps handles: %d\n", ((const struct timer *) heap_get(&h, 42))->id == 42);
+	errors = drain_sorted(&h, &count);
+	printf(" * Popped %zu of %zu after heapify, out of order=%zu\n", count, n, errors);
+	printf("\n");
+	free(array);
+	free(handles);
+	heap_destroy(&h);
+}
+
+/*
+ * Timer loop: <pending> timers outstanding, repeatedly expire the earliest
+ * and schedule a new one a random interval after it
+ */
+static void bench_timers(size_t pending, size_t ops)
+{
+	uint64_t now = 0;
+	uint64_t id = 0;
+	uint64_t check_heap = 0;
+	uint64_t check_tree = 0;
+
+	struct binary_tree tree;
+	binary_tree_init(&tree, timer_compare, NULL, NULL);
+	srand(1);
+	for (size_t i = 0; i < pending; i++) {
+		struct timer t = { now + rand() % 1000000, id++ };
+		binary_tree_insert_new(&tree, &t, sizeof(t));
+	}
+	clock_t start = clock();
+	for (size_t i = 0; i < ops; i++) {
+		struct binary_tree_node **min = binary_tree_min_node(&tree);
+		const struct timer *t = (const struct timer *) (*min)->data;
+		now = t->deadline;
+		check_tree += t->id;
+		binary_tree_delete(&tree, min);
+		struct timer next = { now + rand() % 1000000, id++ };
+		binary_tree_insert_new(&tree, &next, sizeof(next));
+	}
+	const double t_tree = (double) (clock() - start) / CLOCKS_PER_SEC;
+	binary_tree_destroy(&tree);
+
+	printf("Timers: %zu pending, %zu expiries\n", pending, ops);
+	printf(" * binary_tree:  %.3fs\n", t_tree);
+	for (size_t arity = 2; arity <= 8; arity *= 2) {
+		struct heap h;
+		heap_init(&h, sizeof(struct timer), arity, timer_compare, NULL);
+		now = 0;
+		id = 0;
+		check_heap = 0;
+		srand(1);
+		for (size_t i = 0; i < pending; i++) {
+			struct timer t = { now + rand() % 1000000, id++ };
+			heap_push(&h, &t);
+		}
+		start = clock();
+		for (size_t i = 0; i < ops; i++) {
+			struct timer t;
+			heap_pop_min(&h, &t);
+			now = t.deadline;
+			check_heap += t.id;
+			struct timer next = { now + rand() % 1000000, id++ };
+			heap_push(&h, &next);
+		}
+		const double t_heap = (double) (clock() - start) / CLOCKS_PER_SEC;
+		heap_destroy(&h);
+		printf(" * heap arity %zu: %.3fs%s\n", arity, t_heap, check_heap == check_tree ? "" : " (ORDER MISMATCH)");
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	const size_t pending = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+	const size_t ops = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000;
+	test_ops(2);
+	test_ops(4);
+	test_ops(7);
+	bench_timers(pending, ops);
+	return 0;
+}
+#endif
@@ -0,0 +1,67 @@
+#pragma once
+#include <cstd/std.h>
+#include "buffer.h"
+#include "binary_tree.h"
+
+/*
+ * Implicit d-ary min-heap of fixed-size items stored in a buffer.  Each
+ * pushed item gets a handle which stays valid until the item is popped or
+ * removed, for changing its key or removing it in O(log n).
+ *
+ * Items are compared with a binary_tree_comparator (item size is passed as
+ * both lengths).  Items are only aligned to size_t.
+ */
+
+typedef size_t heap_handle;
+
+#define HEAP_NO_HANDLE ((heap_handle) -1)
+#define HEAP_DEFAULT_ARITY 4
+
+struct heap {
+	/* Slots of handle then item */
+	struct buffer slots;
+	/* Slot of each handle, HEAP_NO_HANDLE if unused */
+	struct buffer index;
+	/* Unused handles for reuse */
+	struct buffer free_handles;
+	size_t arity;
+	size_t item_size;
+	size_t item_offset;
+	binary_tree_comparator *compare;
+	void *cmparg;
+	/* One slot, for sifting */
+	void *scratch;
+};
+
+/* Arity 0 for the default (4 keeps siblings within a cache line or two) */
+void heap_init(struct heap *inst, size_t item_size, size_t arity, binary_tree_comparator *cmp, void *cmparg);
+void heap_destroy(struct heap *inst);
+
+size_t heap_size(const struct heap *inst);
+bool heap_empty(const struct heap *inst);
+void heap_clear(struct heap *inst);
+
+heap_handle heap_push(struct heap *inst, const void *item);
+
+/* Minimal item, NULL if empty */
+const void *heap_peek(const struct heap *inst);
+/* Returns false if empty, copies the item to <out> if non-NULL */
+bool heap_pop_min(struct heap *inst, void *out);
+
+/*
+ * Replace contents with n items in O(n), their handles are 0 to n-1 in
+ * array order
+ */
+void heap_heapify(struct heap *inst, const void *items, size_t n);
+
+/* Item for a handle, NULL if the handle is not in use.  Do not edit the key. */
+const void *heap_get(const struct heap *inst, heap_handle handle);
+
+/*
+ * Replace the item of a handle, typically with a smaller key (decrease-key)
+ * though larger keys are also handled
+ */
+void heap_decrease_key(struct heap *inst, heap_handle handle, const void *item);
+
+/* Returns false if handle is not in use, copies the item to <out> if non-NULL */
+bool heap_remove(struct heap *inst, heap_handle handle, void *out);
@@ -0,0 +1,370 @@
+#if 0
+(
+set -euo pipefail
+declare -r tmp="$(mktemp)"
+gcc -I./c_modules -Wall -Wextra -Werror -std=c11 -O0 -g -pthread -DTEST_ilist -o "$tmp" *.c
+exec valgrind --quiet --leak-check=full --track-origins=yes "$tmp"
+)
+exit 0
+#endif
+#include "ilist.h"
+
+/* Proxies for stateless list operators */
+
+static void iterate_proxy(void *state, struct ilist *item)
+{
+	ilist_iterator *cb = (ilist_iterator *) state;
+	cb(item);
+}
+
+static bool predicate_proxy(void *state, struct ilist *item)
+{
+	ilist_predicate *cb = (ilist_predicate *) state;
+	return cb(item);
+}
+
+static void transform_proxy(struct ilist *item, struct ilist **out, void *state)
+{
+	ilist_transformer *cb = (ilist_transformer *) state;
+	cb(item, out);
+}
+
+void ilist_init(struct ilist *item)
+{
+	item->prev = NULL;
+	item->next = NULL;
+}
+
+bool ilist_linked(const struct ilist *item)
+{
+	return item->next != NULL;
+}
+
+bool ilist_empty(const struct ilist *list)
+{
+	return list == NULL;
+}
+
+size_t ilist_length(const struct ilist *list)
+{
+	if (list == NULL) {
+		return 0;
+	}
+	size_t count = 0;
+	const struct ilist *item = list;
+	do {
+		count++;
+		item = item->next;
+	} while (item != list);
+	return count;
+}
+
+void ilist_insert_after(struct ilist **list, struct ilist *item)
+{
+	if (*list == NULL) {
+		item->prev = item;
+		item->next = item;
+		*list = item;
+	} else {
+		item->prev = *list;
+		item->next = (*list)->next;
+		(*list)->next->prev = item;
+		(*list)->next = item;
+	}
+}
+
+void ilist_insert_before(struct ilist **list, struct ilist *item)
+{
+	if (*list == NULL) {
+		item->prev = item;
+		item->next = item;
+		*list = item;
+	} else {
+		item->prev = (*list)->prev;
+		item->next = *list;
+		(*list)->prev->next = item;
+		(*list)->prev = item;
+	}
+}
+
+void ilist_remove(struct ilist **list, struct ilist *item)
+{
+	struct ilist *prev = item->prev;
+	struct ilist *next = item->next;
+	prev->next = next;
+	next->prev = prev;
+	if (prev == item && next == item) {
+		*list = NULL;
+	} else if (item == *list) {
+		*list = next;
+	}
+	ilist_init(item);
+}
+
+void ilist_clear(struct ilist **list)
+{
+	while (*list) {
+		ilist_remove(list, *list);
+	}
+}
+
+void ilist_move_front(struct ilist **list, struct ilist *item)
+{
+	if (item == *list) {
+		return;
+	}
+	/* Unlink without clearing then relink before the head */
+	item->prev->next = item->next;
+	item->next->prev = item->prev;
+	ilist_insert_before(list, item);
+	*list = item;
+}
+
+void ilist_concatenate(struct ilist **list, struct ilist **data)
+{
+	if (*data == NULL) {
+		return;
+	}
+	if (*list == NULL) {
+		*list = *data;
+	} else {
+		struct ilist *a = *list;
+		struct ilist *b = *data;
+		struct ilist *a_tail = a->prev;
+		struct ilist *b_tail = b->prev;
+		a_tail->next = b;
+		b->prev = a_tail;
+		b_tail->next = a;
+		a->prev = b_tail;
+	}
+	*data = NULL;
+}
+
+size_t ilist_each(struct ilist *start, ilist_iterator *cb)
+{
+	return ilist_each_s(start, iterate_proxy, (void *) cb);
+}
+
+size_t ilist_each_s(struct ilist *start, ilist_stateful_iterator *cb, void *state)
+{
+	if (start == NULL) {
+		return 0;
+	}
+	struct ilist *item = start;
+	size_t count = 0;
+	do {
+		cb(state, item);
+		item = item->next;
+		count++;
+	} while (item != start);
+	return count;
+}
+
+size_t ilist_count(struct ilist *start, ilist_predicate *cb)
+{
+	return ilist_count_s(start, predicate_proxy, (void *) cb);
+}
+
+size_t ilist_count_s(struct ilist *start, ilist_stateful_predicate *cb, void *state)
+{
+	if (start == NULL) {
+		return 0;
+	}
+	struct ilist *item = start;
+	size_t count = 0;
+	do {
+		count += cb(state, item) ? 1 : 0;
+		item = item->next;
+	} while (item != start);
+	return count;
+}
+
+size_t ilist_filter(struct ilist **list, ilist_predicate *cb, struct ilist **removed)
+{
+	return ilist_filter_s(list, predicate_proxy, (void *) cb, removed);
+}
+
+size_t ilist_filter_s(struct ilist **list, ilist_stateful_predicate *cb, void *state, struct ilist **removed)
+{
+	/* Visit each item once, removals move the head so it cannot mark the end */
+	size_t count = ilist_length(*list);
+	struct ilist *item = *list;
+	size_t remove_count = 0;
+	while (count--) {
+		struct ilist *next = item->next;
+		if (!cb(state, item)) {
+			ilist_remove(list, item);
+			if (removed != NULL) {
+				ilist_insert_before(removed, item);
+			}
+			remove_count++;
+		}
+		item = next;
+	}
+	return remove_count;
+}
+
+struct ilist *ilist_map(struct ilist *start, ilist_transformer *cb)
+{
+	return ilist_map_s(start, transform_proxy, (void *) cb);
+}
+
+struct ilist *ilist_map_s(struct ilist *start, ilist_stateful_transformer *cb, void *state)
+{
+	if (start == NULL) {
+		return NULL;
+	}
+	struct ilist *in = start;
+	struct ilist *out = NULL;
+	do {
+		cb(in, &out, state);
+		in = in->next;
+	} while (in != start);
+	return out;
+}
+
+struct ilist *ilist_first(struct ilist *start, ilist_predicate *cb)
+{
+	return ilist_first_s(start, predicate_proxy, (void *) cb);
+}
+
+struct ilist *ilist_first_s(struct ilist *start, ilist_stateful_predicate *cb, void *state)
+{
+	if (start == NULL) {
+		return NULL;
+	}
+	struct ilist *item = start;
+	do {
+		if (cb(state, item)) {
+			return item;
+		}
+		item = item->next;
+	} while (item != start);
+	return NULL;
+}
+
+#if defined TEST_ilist
+#include <stdio.h>
+
+struct obj {
+	int value;
+	struct ilist all;
+	struct ilist selected;
+};
+
+static struct obj *all_obj(struct ilist *link)
+{
+	return ilist_entry(link, struct obj, all);
+}
+
+/* Print the values in the ring of <all> links, flagging inconsistent links */
+static void print_list(const char *label, struct ilist *list)
+{
+	bool broken = false;
+	printf("%s", label);
+	struct ilist *item = list;
+	for (size_t n = ilist_length(list); n--; item = item->next) {
+		printf(" %d", all_obj(item)->value);
+		broken |= item->next->prev != item;
+	}
+	printf("%s\n", broken ? " (BROKEN LINKS)" : "");
+}
+
+static void build(struct ilist **list, struct obj *objs, size_t n)
+{
+	*list = NULL;
+	for (size_t i = 0; i < n; i++) {
+		objs[i].value = (int) i;
+		ilist_init(&objs[i].all);
+		ilist_init(&objs[i].selected);
+		ilist_insert_before(list, &objs[i].all);
+	}
+}
+
+static void sum(void *state, struct ilist *item)
+{
+	*(int *) state += all_obj(item)->value;
+}
+
+static bool is_odd(struct ilist *item)
+{
+	return all_obj(item)->value % 2;
+}
+
+/* Keeps items not listed in state (terminated by -1), counting calls */
+struct drop {
+	const int *values;
+	size_t calls;
+};
+
+static bool not_dropped(void *state, struct ilist *item)
+{
+	struct drop *d = state;
+	d->calls++;
+	for (const int *v = d->values; *v >= 0; v++) {
+		if (*v == all_obj(item)->value) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void select_big(struct ilist *item, struct ilist **out)
+{
+	struct obj *o = all_obj(item);
+	if (o->value >= 3) {
+		ilist_insert_before(out, &o->selected);
+	}
+}
+
+static void test_filter(const char *name, const int *drop_values)
+{
+	struct obj objs[5];
+	struct ilist *list;
+	struct ilist *removed = NULL;
+	build(&list, objs, 5);
+	struct drop d = { drop_values, 0 };
+	const size_t n = ilist_filter_s(&list, not_dropped, &d, &removed);
+	printf(" * %s: %zu calls, %zu removed\n", name, d.calls, n);
+	print_list("   kept:   ", list);
+	print_list("   removed:", removed);
+}
+
+int main(int argc, char *argv[])
+{
+	(void) argc;
+	(void) argv;
+	struct obj objs[5];
+	struct ilist *list;
+	build(&list, objs, 5);
+	printf("Operations\n");
+	print_list(" * Built:", list);
+
+	int total = 0;
+	const size_t visited = ilist_each_s(list, sum, &total);
+	printf(" * Each: visited %zu, sum %d\n", visited, total);
+	printf(" * Odd values: %zu, first %d\n", ilist_count(list, is_odd), all_obj(ilist_first(list, is_odd))->value);
+	struct ilist *big = ilist_map(list, select_big);
+	printf(" * Mapped values >= 3: %zu, first %d\n", ilist_length(big), ilist_entry(big, struct obj, selected)->value);
+
+	ilist_move_front(&list, &objs[3].all);
+	print_list(" * Moved 3 to front:", list);
+	ilist_move_front(&list, &objs[4].all);
+	print_list(" * Moved 4 (tail) to front:", list);
+	ilist_move_front(&list, &objs[4].all);
+	print_list(" * Moved 4 (head) to front:", list);
+
+	ilist_clear(&list);
+	printf(" * Cleared: empty=%d, item linked=%d\n", ilist_empty(list), ilist_linked(&objs[0].all));
+	printf("\n");
+
+	printf("Filtering\n");
+	test_filter("Drop head", (int[]) { 0, -1 });
+	test_filter("Drop tail", (int[]) { 4, -1 });
+	test_filter("Drop alternate", (int[]) { 0, 2, 4, -1 });
+	test_filter("Drop all", (int[]) { 0, 1, 2, 3, 4, -1 });
+	test_filter("Drop none", (int[]) { -1 });
+	printf("\n");
+	return 0;
+}
+#endif
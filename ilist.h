@@ -0,0 +1,78 @@
+#pragma once
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Intrusive double-linked circular list: the link is embedded in the user's
+ * object, so linking and unlinking neither allocate nor copy.  An object may
+ * be on several lists at once via several links.
+ */
+
+struct ilist
+{
+	struct ilist *prev;
+	struct ilist *next;
+};
+
+/* Intrusive list is accessed as pointer to head link.  NULL if empty. */
+typedef struct ilist *intrusive_list;
+
+/* Object containing link <ptr>, which is the field <member> of <type> */
+#define ilist_entry(ptr, type, member) \
+	((type *) ((char *) (ptr) - offsetof(type, member)))
+
+typedef void ilist_iterator(struct ilist *item);
+typedef void ilist_stateful_iterator(void *state, struct ilist *item);
+
+typedef bool ilist_predicate(struct ilist *item);
+typedef bool ilist_stateful_predicate(void *state, struct ilist *item);
+
+typedef void ilist_transformer(struct ilist *item, struct ilist **out);
+typedef void ilist_stateful_transformer(struct ilist *item, struct ilist **out, void *state);
+
+/* Clear the link of an object which is not on a list */
+void ilist_init(struct ilist *item);
+/* Whether item is on a list (links are cleared on removal) */
+bool ilist_linked(const struct ilist *item);
+
+bool ilist_empty(const struct ilist *list);
+size_t ilist_length(const struct ilist *list);
+/* Link item before/after the head, the head is set if list is empty */
+void ilist_insert_before(struct ilist **list, struct ilist *item);
+void ilist_insert_after(struct ilist **list, struct ilist *item);
+void ilist_remove(struct ilist **list, struct ilist *item);
+/* Unlink all items, the objects themselves are untouched */
+void ilist_clear(struct ilist **list);
+
+/* Moves item to the head of the list which it is on */
+void ilist_move_front(struct ilist **list, struct ilist *item);
+
+/* Moves all items from <data> to end of <list> in O(1) */
+void ilist_concatenate(struct ilist **list, struct ilist **data);
+
+/* Iterator over each item in the list.  *_s can can be used for reduce/fold */
+size_t ilist_each(struct ilist *start, ilist_iterator *cb);
+size_t ilist_each_s(struct ilist *start, ilist_stateful_iterator *cb, void *state);
+
+/* Count for how many items the predicate returns true */
+size_t ilist_count(struct ilist *start, ilist_predicate *cb);
+size_t ilist_count_s(struct ilist *start, ilist_stateful_predicate *cb, void *state);
+
+/*
+ * Unlink all items for which the predicate returns false, appending them to
+ * <removed> if not NULL.  Returns number of items removed.
+ */
+size_t ilist_filter(struct ilist **list, ilist_predicate *cb, struct ilist **removed);
+size_t ilist_filter_s(struct ilist **list, ilist_stateful_predicate *cb, void *state, struct ilist **removed);
+
+/*
+ * Build a new list by visiting each item, the callback links whichever
+ * objects it chooses into "out" (via some link other than the one being
+ * iterated), so many-to-one / one-to-many mappings are possible
+ */
+struct ilist *ilist_map(struct ilist *start, ilist_transformer *cb);
+struct ilist *ilist_map_s(struct ilist *start, ilist_stateful_transformer *cb, void *state);
+
+/* Returns first item for which predicate is true */
+struct ilist *ilist_first(struct ilist *start, ilist_predicate *cb);
+struct ilist *ilist_first_s(struct ilist *start, ilist_stateful_predicate *cb, void *state);
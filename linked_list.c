@@ -1,8 +1,18 @@
+#if 0
+(
+set -euo pipefail
+declare -r tmp="$(mktemp)"
+gcc -I./c_modules -Wall -Wextra -Werror -std=c11 -O0 -g -pthread -DTEST_linked_list -o "$tmp" *.c
+exec valgrind --quiet --leak-check=full --track-origins=yes "$tmp"
+)
+exit 0
+#endif
 #include <stdlib.h>
 #include <string.h>
 #include "linked_list.h"
 
-static struct list *item_alloc(size_t length, const void *data);
+static struct list *item_alloc(const struct allocator *alloc, size_t length, const void *data);
+static void item_free(const struct allocator *alloc, struct list *item);
 static void item_remove(struct list **list, struct list *item);
 static void item_insert_after(struct list **list, struct list *item);
 static void item_insert_before(struct list **list, struct list *item);
@@ -27,16 +37,26 @@ static void transform_proxy(void *item, struct list **out, void *state)
 	cb(item, out);
 }
 
-static struct list *item_alloc(size_t length, const void *data)
+static bool inplace_transform_proxy(struct list *item, struct list **out, void *state)
 {
-	struct list *item = malloc(sizeof(*item) + length);
-	if (item == NULL) {
-		exit(12);
-	}
+	list_inplace_transformer *cb = (list_inplace_transformer *) state;
+	return cb(item, out);
+}
+
+static struct list *item_alloc(const struct allocator *alloc, size_t length, const void *data)
+{
+	struct list *item = allocator_new(alloc, sizeof(*item) + length);
+	item->length = length;
+	item->capacity = length;
 	memcpy(item->data, data, length);
 	return item;
 }
 
+static void item_free(const struct allocator *alloc, struct list *item)
+{
+	allocator_delete(alloc, item, sizeof(*item) + item->capacity);
+}
+
 static void item_remove(struct list **list, struct list *item)
 {
 	struct list *prev = item->prev;
@@ -52,7 +72,7 @@ static void item_remove(struct list **list, struct list *item)
 
 bool list_empty(const struct list *list)
 {
-	return list != NULL;
+	return list == NULL;
 }
 
 size_t list_length(const struct list *list)
@@ -99,14 +119,14 @@ static void item_insert_before(struct list **list, struct list *item)
 
 struct list *list_insert_after(struct list **list, size_t length, const void *data)
 {
-	struct list *item = item_alloc(length, data);
+	struct list *item = item_alloc(NULL, length, data);
 	item_insert_after(list, item);
 	return item;
 }
 
 struct list *list_insert_before(struct list **list, size_t length, const void *data)
 {
-	struct list *item = item_alloc(length, data);
+	struct list *item = item_alloc(NULL, length, data);
 	item_insert_before(list, item);
 	return item;
 }
@@ -114,7 +134,7 @@ struct list *list_insert_before(struct list **list, size_t length, const void *d
 void list_remove(struct list **list, struct list *item)
 {
 	item_remove(list, item);
-	free(item);
+	item_free(NULL, item);
 }
 
 void list_destroy(struct list **list)
@@ -124,13 +144,184 @@ void list_destroy(struct list **list)
 	}
 }
 
+/* Join ring <b> onto the end of ring <a> (both non-empty) */
+static void ring_splice(struct list *a, struct list *b)
+{
+	struct list *a_tail = a->prev;
+	struct list *b_tail = b->prev;
+	a_tail->next = b;
+	b->prev = a_tail;
+	b_tail->next = a;
+	a->prev = b_tail;
+}
+
 void list_concatenate(struct list **list, struct list **data)
 {
-	while (*data != NULL) {
-		struct list *this = (*data);
-		item_remove(data, this);
-		item_insert_before(list, this);
+	if (*data == NULL) {
+		return;
+	}
+	if (*list == NULL) {
+		*list = *data;
+	} else {
+		ring_splice(*list, *data);
 	}
+	*data = NULL;
+}
+
+/*
+ * Sorting works on chains: the ring is cut open and linked through next
+ * only (NULL-terminated), prev links are restored by close_chain
+ */
+
+static struct list *open_ring(struct list *list)
+{
+	if (list != NULL) {
+		list->prev->next = NULL;
+	}
+	return list;
+}
+
+static struct list *close_chain(struct list *chain)
+{
+	if (chain == NULL) {
+		return NULL;
+	}
+	struct list *prev = chain;
+	for (struct list *item = chain->next; item != NULL; item = item->next) {
+		item->prev = prev;
+		prev = item;
+	}
+	prev->next = chain;
+	chain->prev = prev;
+	return chain;
+}
+
+/* Merge two sorted chains, taking from <a> on ties */
+static struct list *merge_chains(struct list *a, struct list *b, binary_tree_comparator *cmp, void *arg)
+{
+	struct list *head = NULL;
+	struct list **tail = &head;
+	while (a != NULL && b != NULL) {
+		if (cmp(a->data, a->length, b->data, b->length, arg) <= 0) {
+			*tail = a;
+			a = a->next;
+		} else {
+			*tail = b;
+			b = b->next;
+		}
+		tail = &(*tail)->next;
+	}
+	*tail = a != NULL ? a : b;
+	return head;
+}
+
+void list_sort(struct list **list, binary_tree_comparator *cmp, void *arg)
+{
+	/* bins[i] holds a sorted run of 2^i items, older than any in lower bins */
+	struct list *bins[sizeof(size_t) * 8];
+	size_t used = 0;
+	struct list *item = open_ring(*list);
+	while (item != NULL) {
+		struct list *run = item;
+		item = item->next;
+		run->next = NULL;
+		size_t i;
+		for (i = 0; i < used && bins[i] != NULL; i++) {
+			run = merge_chains(bins[i], run, cmp, arg);
+			bins[i] = NULL;
+		}
+		if (i == used) {
+			used++;
+		}
+		bins[i] = run;
+	}
+	struct list *sorted = NULL;
+	for (size_t i = 0; i < used; i++) {
+		if (bins[i] != NULL) {
+			sorted = merge_chains(bins[i], sorted, cmp, arg);
+		}
+	}
+	*list = close_chain(sorted);
+}
+
+void list_merge(struct list **list, struct list **data, binary_tree_comparator *cmp, void *arg)
+{
+	*list = close_chain(merge_chains(open_ring(*list), open_ring(*data), cmp, arg));
+	*data = NULL;
+}
+
+void list_handle_init(struct list_handle *inst, const struct allocator *alloc)
+{
+	inst->head = NULL;
+	inst->length = 0;
+	inst->alloc = alloc;
+}
+
+void list_handle_destroy(struct list_handle *inst)
+{
+	while (inst->head) {
+		list_handle_remove(inst, inst->head);
+	}
+}
+
+bool list_handle_empty(const struct list_handle *inst)
+{
+	return inst->length == 0;
+}
+
+size_t list_handle_length(const struct list_handle *inst)
+{
+	return inst->length;
+}
+
+struct list *list_handle_push_front(struct list_handle *inst, size_t length, const void *data)
+{
+	struct list *item = item_alloc(inst->alloc, length, data);
+	item_insert_before(&inst->head, item);
+	inst->head = item;
+	inst->length++;
+	return item;
+}
+
+struct list *list_handle_push_back(struct list_handle *inst, size_t length, const void *data)
+{
+	struct list *item = item_alloc(inst->alloc, length, data);
+	item_insert_before(&inst->head, item);
+	inst->length++;
+	return item;
+}
+
+struct list *list_handle_insert_after(struct list_handle *inst, struct list *at, size_t length, const void *data)
+{
+	struct list *item = item_alloc(inst->alloc, length, data);
+	item_insert_after(&at, item);
+	inst->length++;
+	return item;
+}
+
+struct list *list_handle_insert_before(struct list_handle *inst, struct list *at, size_t length, const void *data)
+{
+	struct list *item = item_alloc(inst->alloc, length, data);
+	item_insert_before(&at, item);
+	if (at == inst->head) {
+		inst->head = item;
+	}
+	inst->length++;
+	return item;
+}
+
+void list_handle_remove(struct list_handle *inst, struct list *item)
+{
+	item_remove(&inst->head, item);
+	item_free(inst->alloc, item);
+	inst->length--;
+}
+
+void list_handle_splice(struct list_handle *inst, struct list_handle *data)
+{
+	list_concatenate(&inst->head, &data->head);
+	inst->length += data->length;
+	data->length = 0;
 }
 
 size_t list_each(struct list *start, list_iterator *cb)
@@ -177,26 +368,48 @@ size_t list_filter(struct list **list, list_predicate *cb)
 	return list_filter_s(list, predicate_proxy, (void *) cb);
 }
 
-size_t list_filter_s(struct list **list, list_stateful_predicate *cb, void *state)
+static size_t filter(struct list **list, const struct allocator *alloc, list_stateful_predicate *cb, void *state)
 {
-	if (*list == NULL) {
-		return 0;
-	}
+	/* Visit each item once, removals move the head so it cannot mark the end */
+	size_t count = list_length(*list);
 	struct list *item = *list;
 	size_t remove_count = 0;
-	bool remove;
-	do {
+	while (count--) {
 		struct list *next = item->next;
-		remove = !cb(state, item->data);
-		if (remove) {
-			list_remove(list, item);
+		if (!cb(state, item->data)) {
+			item_remove(list, item);
+			item_free(alloc, item);
 			remove_count++;
 		}
 		item = next;
-	} while (*list != NULL && (remove || item != *list));
+	}
 	return remove_count;
 }
 
+size_t list_filter_s(struct list **list, list_stateful_predicate *cb, void *state)
+{
+	return filter(list, NULL, cb, state);
+}
+
+void list_handle_merge(struct list_handle *inst, struct list_handle *data, binary_tree_comparator *cmp, void *arg)
+{
+	list_merge(&inst->head, &data->head, cmp, arg);
+	inst->length += data->length;
+	data->length = 0;
+}
+
+size_t list_handle_filter(struct list_handle *inst, list_predicate *cb)
+{
+	return list_handle_filter_s(inst, predicate_proxy, (void *) cb);
+}
+
+size_t list_handle_filter_s(struct list_handle *inst, list_stateful_predicate *cb, void *state)
+{
+	const size_t removed = filter(&inst->head, inst->alloc, cb, state);
+	inst->length -= removed;
+	return removed;
+}
+
 struct list *list_map(struct list *start, list_transformer *cb)
 {
 	return list_map_s(start, transform_proxy, (void *) cb);
@@ -237,6 +450,50 @@ size_t list_transform_s(struct list **list, list_stateful_transformer *cb, void
 	return count;
 }
 
+size_t list_transform_inplace(struct list **list, list_inplace_transformer *cb)
+{
+	return list_transform_inplace_s(list, inplace_transform_proxy, (void *) cb);
+}
+
+static size_t transform_inplace(struct list **list, const struct allocator *alloc, list_stateful_inplace_transformer *cb, void *state, size_t *dropped)
+{
+	struct list *out = NULL;
+	size_t count = 0;
+	*dropped = 0;
+	while (*list != NULL) {
+		struct list *item = *list;
+		item_remove(list, item);
+		item_insert_before(&out, item);
+		if (!cb(item, &out, state)) {
+			item_remove(&out, item);
+			item_free(alloc, item);
+			(*dropped)++;
+		}
+		count++;
+	}
+	*list = out;
+	return count;
+}
+
+size_t list_transform_inplace_s(struct list **list, list_stateful_inplace_transformer *cb, void *state)
+{
+	size_t dropped;
+	return transform_inplace(list, NULL, cb, state, &dropped);
+}
+
+size_t list_handle_transform_inplace(struct list_handle *inst, list_inplace_transformer *cb)
+{
+	return list_handle_transform_inplace_s(inst, inplace_transform_proxy, (void *) cb);
+}
+
+size_t list_handle_transform_inplace_s(struct list_handle *inst, list_stateful_inplace_transformer *cb, void *state)
+{
+	size_t dropped;
+	const size_t count = transform_inplace(&inst->head, inst->alloc, cb, state, &dropped);
+	inst->length -= dropped;
+	return count;
+}
+
 struct list *list_first(struct list *start, list_predicate *cb)
 {
 	return list_first_s(start, predicate_proxy, (void *) cb);
@@ -256,3 +513,265 @@ struct list *list_first_s(struct list *start, list_stateful_predicate *cb, void
 	} while (item != start);
 	return NULL;
 }
+
+#if defined TEST_linked_list
+#include <stdio.h>
+#include <time.h>
+#include "slab_alloc.h"
+
+/* Print the int values in the ring, flagging inconsistent links */
+static void print_list(const char *label, const struct list *list)
+{
+	bool broken = false;
+	printf("%s", label);
+	const struct list *item = list;
+	for (size_t n = list_length(list); n--; item = item->next) {
+		printf(" %d", *(const int *) item->data);
+		broken |= item->next->prev != item;
+	}
+	printf("%s\n", broken ? " (BROKEN LINKS)" : "");
+}
+
+/* Keeps items not listed in state (terminated by -1), counting calls */
+struct drop {
+	const int *values;
+	size_t calls;
+};
+
+static bool not_dropped(void *state, void *data)
+{
+	struct drop *d = state;
+	d->calls++;
+	for (const int *v = d->values; *v >= 0; v++) {
+		if (*v == *(int *) data) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void test_filter(const struct allocator *alloc, const char *name, const int *drop_values)
+{
+	struct list_handle h;
+	list_handle_init(&h, alloc);
+	for (int i = 0; i < 5; i++) {
+		list_handle_push_back(&h, sizeof(i), &i);
+	}
+	struct drop d = { drop_values, 0 };
+	const size_t n = list_handle_filter_s(&h, not_dropped, &d);
+	printf(" * %s: %zu calls, %zu removed, length %zu\n", name, d.calls, n, list_handle_length(&h));
+	print_list("   kept:", h.head);
+	list_handle_destroy(&h);
+}
+
+static void test_handle(const char *name, const struct allocator *alloc)
+{
+	struct list_handle a;
+	struct list_handle b;
+	list_handle_init(&a, alloc);
+	list_handle_init(&b, alloc);
+	for (int i = 1; i < 3; i++) {
+		list_handle_push_back(&a, sizeof(i), &i);
+		const int j = i + 2;
+		list_handle_push_back(&b, sizeof(j), &j);
+	}
+	const int zero = 0;
+	list_handle_push_front(&a, sizeof(zero), &zero);
+	list_handle_splice(&a, &b);
+	printf("Handles (%s)\n", name);
+	printf(" * Splice: source empty=%d, length %zu\n", list_handle_empty(&b), list_handle_length(&a));
+	print_list("   items:", a.head);
+	list_handle_destroy(&a);
+
+	test_filter(alloc, "Drop head", (int[]) { 0, -1 });
+	test_filter(alloc, "Drop tail", (int[]) { 4, -1 });
+	test_filter(alloc, "Drop alternate", (int[]) { 0, 2, 4, -1 });
+	test_filter(alloc, "Drop all", (int[]) { 0, 1, 2, 3, 4, -1 });
+	test_filter(alloc, "Drop none", (int[]) { -1 });
+	printf("\n");
+}
+
+struct keyed {
+	int key;
+	int seq;
+};
+
+static int compare_keyed(const void *a, size_t al, const void *b, size_t bl, void *arg)
+{
+	(void) al;
+	(void) bl;
+	(void) arg;
+	const struct keyed *x = a;
+	const struct keyed *y = b;
+	return (x->key > y->key) - (x->key < y->key);
+}
+
+/*
+ * Sorted by key, equal keys in seq order, links consistent: returns the
+ * number of items which are not
+ */
+static size_t count_unsorted(const struct list *list, size_t n)
+{
+	size_t errors = list_length(list) != n;
+	const struct list *item = list;
+	for (size_t i = 0; i < n && item != NULL; i++, item = item->next) {
+		errors += item->next->prev != item || item->prev->next != item;
+		if (i > 0) {
+			const struct keyed *p = (const void *) item->prev->data;
+			const struct keyed *q = (const void *) item->data;
+			errors += p->key > q->key || (p->key == q->key && p->seq > q->seq);
+		}
+	}
+	return errors;
+}
+
+static struct list *keyed_list(size_t n, int keys, int seq, unsigned *rng)
+{
+	struct list *list = NULL;
+	for (size_t i = 0; i < n; i++) {
+		*rng = *rng * 1103515245 + 12345;
+		struct keyed k = { (int) (*rng >> 16) % keys, seq + (int) i };
+		list_insert_before(&list, sizeof(k), &k);
+	}
+	return list;
+}
+
+static void test_sort(size_t max)
+{
+	unsigned rng = 1;
+	size_t sort_errors = 0;
+	size_t merge_errors = 0;
+	for (size_t n = 0; n <= max; n++) {
+		struct list *list = keyed_list(n, 7, 0, &rng);
+		list_sort(&list, compare_keyed, NULL);
+		sort_errors += count_unsorted(list, n);
+		list_destroy(&list);
+	}
+	for (size_t n = 0; n <= 20; n++) {
+		for (size_t m = 0; m <= 20; m++) {
+			struct list *a = keyed_list(n, 5, 0, &rng);
+			struct list *b = keyed_list(m, 5, 1000, &rng);
+			list_sort(&a, compare_keyed, NULL);
+			list_sort(&b, compare_keyed, NULL);
+			list_merge(&a, &b, compare_keyed, NULL);
+			/* seq ordering also checks that <a> wins ties */
+			merge_errors += (b != NULL) + count_unsorted(a, n + m);
+			list_destroy(&a);
+		}
+	}
+	printf("Sorting\n");
+	printf(" * Sort lists of 0-%zu items: errors=%zu\n", max, sort_errors);
+	printf(" * Merge pairs of 0-20 items: errors=%zu\n", merge_errors);
+	printf("\n");
+}
+
+/* Drop multiples of 3, shrink evens to a single byte, leave the rest */
+static bool shrink_some(struct list *item, struct list **out)
+{
+	(void) out;
+	const int value = *(int *) item->data;
+	if (value % 3 == 0) {
+		return false;
+	}
+	if (value % 2 == 0) {
+		item->length = 1;
+	}
+	return true;
+}
+
+static bool double_and_tag(struct list *item, struct list **out)
+{
+	int *value = (int *) item->data;
+	*value *= 2;
+	if (*value % 10 == 0) {
+		const int tag = -*value;
+		list_insert_before(out, sizeof(tag), &tag);
+	}
+	return *value % 3 != 0;
+}
+
+static size_t slab_items(const struct slab_alloc *sa)
+{
+	size_t items = 0;
+	for (size_t i = 0; i < SLAB_ALLOC_CLASSES; i++) {
+		items += sa->classes[i].items;
+	}
+	return items;
+}
+
+static void test_transform_inplace(void)
+{
+	struct list *list = NULL;
+	for (int i = 1; i < 8; i++) {
+		list_insert_before(&list, sizeof(i), &i);
+	}
+	printf("In-place transform\n");
+	printf(" * Doubling 1-7, dropping multiples of 3, tagging multiples of 10: %zu visited\n", list_transform_inplace(&list, double_and_tag));
+	print_list("   items:", list);
+	list_destroy(&list);
+
+	/* Shrunk items must go back to the size class they came from */
+	struct slab_alloc sa;
+	slab_alloc_init(&sa);
+	struct list_handle h;
+	list_handle_init(&h, slab_alloc_allocator(&sa));
+	for (int i = 0; i < 1000; i++) {
+		char payload[100] = { 0 };
+		memcpy(payload, &i, sizeof(i));
+		list_handle_push_back(&h, sizeof(payload), payload);
+	}
+	list_handle_transform_inplace(&h, shrink_some);
+	printf(" * Shrinking 1000 slab items: length %zu, counted %zu\n", list_handle_length(&h), list_length(h.head));
+	list_handle_destroy(&h);
+	printf("   Slab items left after destroy: %zu\n", slab_items(&sa));
+	slab_alloc_destroy(&sa);
+	printf("\n");
+}
+
+static void double_copy(void *data, struct list **out)
+{
+	const int value = *(int *) data * 2;
+	list_insert_before(out, sizeof(value), &value);
+}
+
+static bool double_inplace(struct list *item, struct list **out)
+{
+	(void) out;
+	*(int *) item->data *= 2;
+	return true;
+}
+
+/* One-to-one rewrite of n items, allocating versus reusing nodes */
+static void bench_transform(size_t n)
+{
+	struct list *list = NULL;
+	for (int i = 0; i < (int) n; i++) {
+		list_insert_before(&list, sizeof(i), &i);
+	}
+	clock_t start = clock();
+	list_transform(&list, double_copy);
+	const double t_copy = (double) (clock() - start) / CLOCKS_PER_SEC;
+	start = clock();
+	list_transform_inplace(&list, double_inplace);
+	const double t_inplace = (double) (clock() - start) / CLOCKS_PER_SEC;
+	const bool correct = *(int *) list->prev->data == (int) (n - 1) * 4;
+	list_destroy(&list);
+	printf("Doubling %zu items%s\n", n, correct ? "" : " (WRONG RESULTS)");
+	printf(" * list_transform:         %.3fs\n", t_copy);
+	printf(" * list_transform_inplace: %.3fs\n", t_inplace);
+}
+
+int main(int argc, char *argv[])
+{
+	const size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+	test_sort(300);
+	test_transform_inplace();
+	struct slab_alloc sa;
+	slab_alloc_init(&sa);
+	test_handle("malloc", NULL);
+	test_handle("slab_alloc", slab_alloc_allocator(&sa));
+	slab_alloc_destroy(&sa);
+	bench_transform(n);
+	return 0;
+}
+#endif
@@ -1,6 +1,8 @@
 #pragma once
 #include <stddef.h>
 #include <stdbool.h>
+#include "allocator.h"
+#include "binary_tree.h"
 
 /* Double-linked circular list, data is stored/copied into list items */
 
@@ -9,6 +11,8 @@ struct list
 	struct list *prev;
 	struct list *next;
 	size_t length;
+	/* Bytes allocated for data, length may be reduced below it in place */
+	size_t capacity;
 	char data[];
 };
 
@@ -24,6 +28,9 @@ typedef bool list_stateful_predicate(void *state, void *data);
 typedef void list_transformer(void *data, struct list **out);
 typedef void list_stateful_transformer(void *data, struct list **out, void *state);
 
+typedef bool list_inplace_transformer(struct list *item, struct list **out);
+typedef bool list_stateful_inplace_transformer(struct list *item, struct list **out, void *state);
+
 bool list_empty(const struct list *list);
 size_t list_length(const struct list *list);
 struct list *list_insert_before(struct list **list, size_t length, const void *data);
@@ -31,9 +38,68 @@ struct list *list_insert_after(struct list **list, size_t length, const void *da
 void list_remove(struct list **list, struct list *item);
 void list_destroy(struct list **list);
 
-/* Moves all items from <data> to end of <list> */
+/* Moves all items from <data> to end of <list> in O(1) */
 void list_concatenate(struct list **list, struct list **data);
 
+/*
+ * Stable merge sort which relinks the items in place (no allocation), the
+ * comparator receives item data and lengths
+ */
+void list_sort(struct list **list, binary_tree_comparator *cmp, void *arg);
+
+/*
+ * Merge sorted list <data> into sorted list <list>, items of <list> come
+ * first on ties.  <data> is left empty.
+ */
+void list_merge(struct list **list, struct list **data, binary_tree_comparator *cmp, void *arg);
+
+/*
+ * Handle for a list which tracks its length and item allocator (NULL for
+ * malloc, or e.g. slab_alloc_allocator to pool items).  The head may be
+ * passed to the iteration functions below, but items must only be added or
+ * removed via the handle.
+ */
+struct list_handle {
+	struct list *head;
+	size_t length;
+	const struct allocator *alloc;
+};
+
+void list_handle_init(struct list_handle *inst, const struct allocator *alloc);
+void list_handle_destroy(struct list_handle *inst);
+
+bool list_handle_empty(const struct list_handle *inst);
+/* O(1) */
+size_t list_handle_length(const struct list_handle *inst);
+
+struct list *list_handle_push_front(struct list_handle *inst, size_t length, const void *data);
+struct list *list_handle_push_back(struct list_handle *inst, size_t length, const void *data);
+/* Insert after/before an item of this list */
+struct list *list_handle_insert_after(struct list_handle *inst, struct list *at, size_t length, const void *data);
+struct list *list_handle_insert_before(struct list_handle *inst, struct list *at, size_t length, const void *data);
+void list_handle_remove(struct list_handle *inst, struct list *item);
+
+/*
+ * Moves all items from <data> to end of <inst> in O(1), both handles must
+ * use the same allocator
+ */
+void list_handle_splice(struct list_handle *inst, struct list_handle *data);
+
+/* As list_merge, for handles (use list_sort on the head to sort) */
+void list_handle_merge(struct list_handle *inst, struct list_handle *data, binary_tree_comparator *cmp, void *arg);
+
+/* As list_filter, for handles */
+size_t list_handle_filter(struct list_handle *inst, list_predicate *cb);
+size_t list_handle_filter_s(struct list_handle *inst, list_stateful_predicate *cb, void *state);
+
+/*
+ * As list_transform_inplace, dropped items are returned to the handle's
+ * allocator.  The callback must not add items to "out" (they would not come
+ * from that allocator), so only one-to-one mappings and drops are possible.
+ */
+size_t list_handle_transform_inplace(struct list_handle *inst, list_inplace_transformer *cb);
+size_t list_handle_transform_inplace_s(struct list_handle *inst, list_stateful_inplace_transformer *cb, void *state);
+
 /* Iterator over each item in the list.  *_s can can be used for reduce/fold */
 size_t list_each(struct list *start, list_iterator *cb);
 size_t list_each_s(struct list *start, list_stateful_iterator *cb, void *state);
@@ -64,6 +130,17 @@ struct list *list_map_s(struct list *start, list_stateful_transformer *cb, void
 size_t list_transform(struct list **list, list_transformer *cb);
 size_t list_transform_s(struct list **list, list_stateful_transformer *cb, void *state);
 
+/*
+ * Like transform but reuses the nodes: the callback may rewrite item->data
+ * in place (reducing item->length if needed, never increasing it) and
+ * returns true to keep the item or false to have it freed.  Kept items are
+ * relinked onto the output list before the callback is invoked, so items
+ * which the callback adds to "out" follow it.  Items keep their allocated
+ * capacity, so they are freed with the size they were allocated with.
+ */
+size_t list_transform_inplace(struct list **list, list_inplace_transformer *cb);
+size_t list_transform_inplace_s(struct list **list, list_stateful_inplace_transformer *cb, void *state);
+
 /* Returns first item for which predicate is true */
 struct list *list_first(struct list *start, list_predicate *cb);
 struct list *list_first_s(struct list *start, list_stateful_predicate *cb, void *state);
@@ -0,0 +1,257 @@
+#if 0
+(
+set -euo pipefail
+declare -r tmp="$(mktemp)"
+gcc -I./c_modules -Wall -Wextra -Werror -std=c11 -O0 -g -pthread -DTEST_mpmc_queue -o "$tmp" *.c
+exec valgrind --quiet --leak-check=full --track-origins=yes "$tmp"
+)
+exit 0
+#endif
+#include <cstd/std.h>
+#include "mpmc_queue.h"
+
+void mpmc_queue_init(struct mpmc_queue *inst, size_t item_size, size_t capacity)
+{
+	size_t size = 2;
+	while (size < capacity) {
+		size <<= 1;
+	}
+	const size_t align = _Alignof(atomic_size_t);
+	inst->item_size = item_size;
+	inst->cell_offset = sizeof(atomic_size_t);
+	const size_t cell_size = (inst->cell_offset + item_size + align - 1) / align * align;
+	buffer_init_growth(&inst->ring, cell_size, size, BUFFER_GROW_FIXED, size);
+	inst->mask = size - 1;
+	for (size_t i = 0; i < size; i++) {
+		atomic_init((atomic_size_t *) buffer_ptr(&inst->ring, i), i);
+	}
+	atomic_init(&inst->head, 0);
+	atomic_init(&inst->tail, 0);
+}
+
+static atomic_size_t *cell_seq(struct mpmc_queue *inst, size_t pos)
+{
+	return buffer_ptr(&inst->ring, pos & inst->mask);
+}
+
+static void *cell_data(struct mpmc_queue *inst, size_t pos)
+{
+	return (char *) buffer_ptr(&inst->ring, pos & inst->mask) + inst->cell_offset;
+}
+
+/*
+ * Claim up to n cells starting at *pos on <cursor>.  A cell is ready when its
+ * sequence equals pos + i + lag (lag is 0 for producers, 1 for consumers).
+ */
+static size_t claim(struct mpmc_queue *inst, atomic_size_t *cursor, size_t lag, size_t n, size_t *out_pos)
+{
+	size_t pos = atomic_load_explicit(cursor, memory_order_relaxed);
+	for (;;) {
+		size_t ready = 0;
+		ptrdiff_t dif = 0;
+		while (ready < n) {
+			const size_t seq = atomic_load_explicit(cell_seq(inst, pos + ready), memory_order_acquire);
+			dif = (ptrdiff_t) (seq - (pos + ready + lag));
+			if (dif != 0) {
+				break;
+			}
+			ready++;
+		}
+		if (ready == 0 && dif > 0) {
+			/* Another thread claimed this cell, retry from new position */
+			pos = atomic_load_explicit(cursor, memory_order_relaxed);
+			continue;
+		}
+		if (ready == 0) {
+			/* Full (producer) or empty (consumer) */
+			return 0;
+		}
+		if (atomic_compare_exchange_weak_explicit(cursor, &pos, pos + ready, memory_order_relaxed, memory_order_relaxed)) {
+			*out_pos = pos;
+			return ready;
+		}
+	}
+}
+
+size_t mpmc_queue_push_n(struct mpmc_queue *inst, const void *in, size_t n)
+{
+	size_t pos;
+	n = claim(inst, &inst->tail, 0, n, &pos);
+	const char *p = in;
+	for (size_t i = 0; i < n; i++, p += inst->item_size) {
+		memcpy(cell_data(inst, pos + i), p, inst->item_size);
+		atomic_store_explicit(cell_seq(inst, pos + i), pos + i + 1, memory_order_release);
+	}
+	return n;
+}
+
+size_t mpmc_queue_pop_n(struct mpmc_queue *inst, void *out, size_t n)
+{
+	size_t pos;
+	n = claim(inst, &inst->head, 1, n, &pos);
+	char *p = out;
+	for (size_t i = 0; i < n; i++, p += inst->item_size) {
+		memcpy(p, cell_data(inst, pos + i), inst->item_size);
+		atomic_store_explicit(cell_seq(inst, pos + i), pos + i + inst->mask + 1, memory_order_release);
+	}
+	return n;
+}
+
+bool mpmc_queue_push(struct mpmc_queue *inst, const void *in)
+{
+	return mpmc_queue_push_n(inst, in, 1) == 1;
+}
+
+bool mpmc_queue_pop(struct mpmc_queue *inst, void *out)
+{
+	return mpmc_queue_pop_n(inst, out, 1) == 1;
+}
+
+size_t mpmc_queue_capacity(const struct mpmc_queue *inst)
+{
+	return inst->mask + 1;
+}
+
+void mpmc_queue_destroy(struct mpmc_queue *inst)
+{
+	buffer_destroy(&inst->ring);
+}
+
+#if defined TEST_mpmc_queue
+#include <threads.h>
+#include <time.h>
+
+#define MAX_THREADS 64
+
+struct bench {
+	struct mpmc_queue queue;
+	/* Mutex-protected buffer with erase from the front, for comparison */
+	bool locked;
+	mtx_t lock;
+	struct buffer locked_queue;
+	size_t per_producer;
+	size_t batch;
+	atomic_size_t consumed;
+	atomic_size_t sum;
+	size_t total;
+};
+
+static size_t bench_push(struct bench *b, const size_t *items, size_t n)
+{
+	if (!b->locked) {
+		return mpmc_queue_push_n(&b->queue, items, n);
+	}
+	mtx_lock(&b->lock);
+	if (b->locked_queue.length + n > 1024) {
+		n = 1024 - b->locked_queue.length;
+	}
+	buffer_append_n(&b->locked_queue, items, n);
+	mtx_unlock(&b->lock);
+	return n;
+}
+
+static size_t bench_pop(struct bench *b, size_t *items, size_t n)
+{
+	if (!b->locked) {
+		return mpmc_queue_pop_n(&b->queue, items, n);
+	}
+	mtx_lock(&b->lock);
+	if (n > b->locked_queue.length) {
+		n = b->locked_queue.length;
+	}
+	memcpy(items, buffer_cdata(&b->locked_queue), n * sizeof(*items));
+	buffer_erase_range(&b->locked_queue, 0, n);
+	mtx_unlock(&b->lock);
+	return n;
+}
+
+static int producer(void *arg)
+{
+	struct bench *b = arg;
+	size_t items[64];
+	for (size_t i = 0; i < b->per_producer; ) {
+		const size_t n = b->per_producer - i < b->batch ? b->per_producer - i : b->batch;
+		for (size_t j = 0; j < n; j++) {
+			items[j] = i + j;
+		}
+		for (size_t done = 0; done < n; ) {
+			const size_t pushed = bench_push(b, items + done, n - done);
+			if (pushed == 0) {
+				thrd_yield();
+			}
+			done += pushed;
+		}
+		i += n;
+	}
+	return 0;
+}
+
+static int consumer(void *arg)
+{
+	struct bench *b = arg;
+	size_t items[64];
+	size_t sum = 0;
+	while (atomic_load(&b->consumed) < b->total) {
+		const size_t n = bench_pop(b, items, b->batch);
+		if (n == 0) {
+			thrd_yield();
+			continue;
+		}
+		for (size_t i = 0; i < n; i++) {
+			sum += items[i];
+		}
+		atomic_fetch_add(&b->consumed, n);
+	}
+	atomic_fetch_add(&b->sum, sum);
+	return 0;
+}
+
+static void bench_mpmc(size_t threads, size_t count, size_t batch, bool locked)
+{
+	struct bench b;
+	struct timespec start;
+	struct timespec end;
+	thrd_t producers[MAX_THREADS];
+	thrd_t consumers[MAX_THREADS];
+	mpmc_queue_init(&b.queue, sizeof(size_t), 1024);
+	b.locked = locked;
+	mtx_init(&b.lock, mtx_plain);
+	buffer_init(&b.locked_queue, sizeof(size_t), 1024, 1024);
+	b.per_producer = count / threads;
+	b.batch = batch;
+	b.total = b.per_producer * threads;
+	atomic_init(&b.consumed, 0);
+	atomic_init(&b.sum, 0);
+	timespec_get(&start, TIME_UTC);
+	for (size_t i = 0; i < threads; i++) {
+		thrd_create(&producers[i], producer, &b);
+		thrd_create(&consumers[i], consumer, &b);
+	}
+	for (size_t i = 0; i < threads; i++) {
+		thrd_join(producers[i], NULL);
+		thrd_join(consumers[i], NULL);
+	}
+	timespec_get(&end, TIME_UTC);
+	const double t = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+	const size_t expect = threads * (b.per_producer * (b.per_producer - 1) / 2);
+	printf(" * %-6s %2zux%-2zu batch=%-3zu %.1f Mitems/s%s\n", locked ? "mutex" : "mpmc", threads, threads, batch, b.total / t * 1e-6, atomic_load(&b.sum) == expect ? "" : " (CHECKSUM MISMATCH)");
+	buffer_destroy(&b.locked_queue);
+	mtx_destroy(&b.lock);
+	mpmc_queue_destroy(&b.queue);
+}
+
+int main(int argc, char *argv[])
+{
+	const size_t count = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+	const size_t max_threads = argc > 2 ? strtoul(argv[2], NULL, 0) : 8;
+
+	printf("Producers x consumers throughput\n");
+	for (size_t threads = 1; threads <= max_threads && threads <= MAX_THREADS; threads *= 2) {
+		bench_mpmc(threads, count, 1, true);
+		bench_mpmc(threads, count, 1, false);
+		bench_mpmc(threads, count, 16, false);
+	}
+	printf("\n");
+	return 0;
+}
+#endif
@@ -0,0 +1,40 @@
+#pragma once
+#include <cstd/std.h>
+#include <stdatomic.h>
+#include "buffer.h"
+#include "cache_line.h"
+
+/*
+ * Bounded lock-free multi-producer/multi-consumer queue of fixed-size items
+ * (Vyukov's array queue).  Each ring cell holds a sequence number followed
+ * by the item, the sequence tells producers and consumers whose turn it is.
+ */
+
+struct mpmc_queue {
+	/* Cells of cell_offset + item_size bytes */
+	struct buffer ring;
+	size_t mask;
+	size_t item_size;
+	size_t cell_offset;
+	_Alignas(CACHE_LINE_SIZE) atomic_size_t head;
+	_Alignas(CACHE_LINE_SIZE) atomic_size_t tail;
+};
+
+/* Capacity is rounded up to a power of two (minimum 2) */
+void mpmc_queue_init(struct mpmc_queue *inst, size_t item_size, size_t capacity);
+
+/* Returns false if full */
+bool mpmc_queue_push(struct mpmc_queue *inst, const void *in);
+/* Returns false if empty */
+bool mpmc_queue_pop(struct mpmc_queue *inst, void *out);
+
+/*
+ * Claim up to n consecutive cells with a single CAS, returns number of items
+ * transferred
+ */
+size_t mpmc_queue_push_n(struct mpmc_queue *inst, const void *in, size_t n);
+size_t mpmc_queue_pop_n(struct mpmc_queue *inst, void *out, size_t n);
+
+size_t mpmc_queue_capacity(const struct mpmc_queue *inst);
+
+void mpmc_queue_destroy(struct mpmc_queue *inst);
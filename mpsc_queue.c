@@ -0,0 +1,224 @@
+#if 0
+(
+set -euo pipefail
+declare -r tmp="$(mktemp)"
+gcc -I./c_modules -Wall -Wextra -Werror -std=c11 -O0 -g -pthread -DTEST_mpsc_queue -o "$tmp" *.c
+exec valgrind --quiet --leak-check=full --track-origins=yes "$tmp"
+)
+exit 0
+#endif
+#include <cstd/std.h>
+#include "mpsc_queue.h"
+
+void mpsc_queue_init(struct mpsc_queue *inst)
+{
+	atomic_init(&inst->stub.next, NULL);
+	atomic_init(&inst->tail, &inst->stub);
+	inst->head = &inst->stub;
+}
+
+void mpsc_queue_push(struct mpsc_queue *inst, struct mpsc_queue_link *item)
+{
+	atomic_store_explicit(&item->next, NULL, memory_order_relaxed);
+	struct mpsc_queue_link *prev = atomic_exchange_explicit(&inst->tail, item, memory_order_acq_rel);
+	/* Until this store the consumer sees the queue end at prev */
+	atomic_store_explicit(&prev->next, item, memory_order_release);
+}
+
+struct mpsc_queue_link *mpsc_queue_pop(struct mpsc_queue *inst)
+{
+	struct mpsc_queue_link *head = inst->head;
+	struct mpsc_queue_link *next = atomic_load_explicit(&head->next, memory_order_acquire);
+	if (head == &inst->stub) {
+		if (next == NULL) {
+			return NULL;
+		}
+		inst->head = next;
+		head = next;
+		next = atomic_load_explicit(&head->next, memory_order_acquire);
+	}
+	if (next != NULL) {
+		inst->head = next;
+		return head;
+	}
+	/* head is the last link unless a push is in progress */
+	if (head != atomic_load_explicit(&inst->tail, memory_order_acquire)) {
+		return NULL;
+	}
+	/* Re-insert the stub so head can be detached */
+	mpsc_queue_push(inst, &inst->stub);
+	next = atomic_load_explicit(&head->next, memory_order_acquire);
+	if (next != NULL) {
+		inst->head = next;
+		return head;
+	}
+	return NULL;
+}
+
+size_t mpsc_queue_drain(struct mpsc_queue *inst, mpsc_queue_callback *cb, void *arg)
+{
+	size_t count = 0;
+	struct mpsc_queue_link *item;
+	while ((item = mpsc_queue_pop(inst)) != NULL) {
+		cb(arg, item);
+		count++;
+	}
+	return count;
+}
+
+bool mpsc_queue_empty(struct mpsc_queue *inst)
+{
+	return inst->head == &inst->stub && atomic_load_explicit(&inst->stub.next, memory_order_acquire) == NULL;
+}
+
+#if defined TEST_mpsc_queue
+#include <threads.h>
+#include <time.h>
+#include "linked_list.h"
+
+#define MAX_THREADS 64
+
+struct event {
+	struct mpsc_queue_link link;
+	size_t producer;
+	size_t value;
+};
+
+struct bench {
+	struct mpsc_queue queue;
+	/* Mutex-protected linked_list for comparison */
+	bool locked;
+	mtx_t lock;
+	struct list *locked_list;
+	struct event *events[MAX_THREADS];
+	size_t per_producer;
+	size_t total;
+	/* Consumer state */
+	size_t consumed;
+	size_t sum;
+	size_t next_value[MAX_THREADS];
+	bool out_of_order;
+};
+
+struct producer_arg {
+	struct bench *bench;
+	size_t id;
+};
+
+static int producer(void *arg)
+{
+	struct producer_arg *pa = arg;
+	struct bench *b = pa->bench;
+	struct event *events = b->events[pa->id];
+	for (size_t i = 0; i < b->per_producer; i++) {
+		if (b->locked) {
+			struct event ev = { .producer = pa->id, .value = i };
+			mtx_lock(&b->lock);
+			list_insert_before(&b->locked_list, sizeof(ev), &ev);
+			mtx_unlock(&b->lock);
+		} else {
+			events[i].producer = pa->id;
+			events[i].value = i;
+			mpsc_queue_push(&b->queue, &events[i].link);
+		}
+	}
+	return 0;
+}
+
+static void consume(struct bench *b, const struct event *ev)
+{
+	if (ev->value != b->next_value[ev->producer]) {
+		b->out_of_order = true;
+	}
+	b->next_value[ev->producer] = ev->value + 1;
+	b->sum += ev->value;
+	b->consumed++;
+}
+
+static void consume_link(void *arg, struct mpsc_queue_link *item)
+{
+	consume(arg, mpsc_queue_entry(item, struct event, link));
+}
+
+static void consume_list(void *state, void *data)
+{
+	consume(state, data);
+}
+
+static void consumer(struct bench *b)
+{
+	while (b->consumed < b->total) {
+		size_t n;
+		if (b->locked) {
+			mtx_lock(&b->lock);
+			struct list *batch = b->locked_list;
+			b->locked_list = NULL;
+			mtx_unlock(&b->lock);
+			n = list_each_s(batch, consume_list, b);
+			list_destroy(&batch);
+		} else {
+			n = mpsc_queue_drain(&b->queue, consume_link, b);
+		}
+		if (n == 0) {
+			thrd_yield();
+		}
+	}
+}
+
+static void bench_mpsc(size_t threads, size_t count, bool locked)
+{
+	struct bench b;
+	struct timespec start;
+	struct timespec end;
+	thrd_t producers[MAX_THREADS];
+	struct producer_arg args[MAX_THREADS];
+	mpsc_queue_init(&b.queue);
+	b.locked = locked;
+	mtx_init(&b.lock, mtx_plain);
+	b.locked_list = NULL;
+	b.per_producer = count / threads;
+	b.total = b.per_producer * threads;
+	b.consumed = 0;
+	b.sum = 0;
+	b.out_of_order = false;
+	for (size_t i = 0; i < threads; i++) {
+		b.events[i] = malloc(b.per_producer * sizeof(struct event));
+		if (b.events[i] == NULL) {
+			exit(12);
+		}
+		b.next_value[i] = 0;
+		args[i].bench = &b;
+		args[i].id = i;
+	}
+	timespec_get(&start, TIME_UTC);
+	for (size_t i = 0; i < threads; i++) {
+		thrd_create(&producers[i], producer, &args[i]);
+	}
+	consumer(&b);
+	for (size_t i = 0; i < threads; i++) {
+		thrd_join(producers[i], NULL);
+	}
+	timespec_get(&end, TIME_UTC);
+	const double t = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+	const size_t expect = threads * (b.per_producer * (b.per_producer - 1) / 2);
+	printf(" * %-6s %2zu producers %.1f Mitems/s%s%s\n", locked ? "mutex" : "mpsc", threads, b.total / t * 1e-6, b.sum == expect ? "" : " (CHECKSUM MISMATCH)", b.out_of_order ? " (OUT OF ORDER)" : "");
+	for (size_t i = 0; i < threads; i++) {
+		free(b.events[i]);
+	}
+	mtx_destroy(&b.lock);
+}
+
+int main(int argc, char *argv[])
+{
+	const size_t count = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+	const size_t max_threads = argc > 2 ? strtoul(argv[2], NULL, 0) : 8;
+
+	printf("Producers to one consumer throughput\n");
+	for (size_t threads = 1; threads <= max_threads && threads <= MAX_THREADS; threads *= 2) {
+		bench_mpsc(threads, count, true);
+		bench_mpsc(threads, count, false);
+	}
+	printf("\n");
+	return 0;
+}
+#endif
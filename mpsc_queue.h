@@ -0,0 +1,48 @@
+#pragma once
+#include <cstd/std.h>
+#include <stdatomic.h>
+#include "cache_line.h"
+
+/*
+ * Unbounded lock-free intrusive multi-producer/single-consumer queue
+ * (Vyukov's node queue).  Like struct ilist the link is embedded in the
+ * user's object, so queueing neither allocates nor copies.  Producers push
+ * with a single atomic exchange; the consumer pops without atomic
+ * read-modify-write operations and may drain everything available at once.
+ */
+
+struct mpsc_queue_link {
+	_Atomic(struct mpsc_queue_link *) next;
+};
+
+/* Object containing link <ptr>, which is the field <member> of <type> */
+#define mpsc_queue_entry(ptr, type, member) \
+	((type *) ((char *) (ptr) - offsetof(type, member)))
+
+typedef void mpsc_queue_callback(void *arg, struct mpsc_queue_link *item);
+
+struct mpsc_queue {
+	/* Last pushed link, exchanged by producers */
+	_Alignas(CACHE_LINE_SIZE) _Atomic(struct mpsc_queue_link *) tail;
+	/* Next link to pop, owned by the consumer */
+	_Alignas(CACHE_LINE_SIZE) struct mpsc_queue_link *head;
+	/* Placeholder which keeps the queue non-empty */
+	struct mpsc_queue_link stub;
+};
+
+void mpsc_queue_init(struct mpsc_queue *inst);
+
+/* Any thread.  The link must not be on a queue. */
+void mpsc_queue_push(struct mpsc_queue *inst, struct mpsc_queue_link *item);
+
+/*
+ * Consumer only.  Returns NULL if empty, or if the next item's producer is
+ * still between its exchange and its link (retry later).
+ */
+struct mpsc_queue_link *mpsc_queue_pop(struct mpsc_queue *inst);
+
+/* Consumer only.  Pop and pass to cb until empty, returns number popped */
+size_t mpsc_queue_drain(struct mpsc_queue *inst, mpsc_queue_callback *cb, void *arg);
+
+/* Consumer only */
+bool mpsc_queue_empty(struct mpsc_queue *inst);
@@ -0,0 +1,146 @@
+#if 0
+(
+set -euo pipefail
+declare -r tmp="$(mktemp)"
+gcc -I./c_modules -Wall -Wextra -Werror -std=c11 -O0 -g -pthread -DTEST_slab_alloc -o "$tmp" *.c
+exec valgrind --quiet --leak-check=full --track-origins=yes "$tmp"
+)
+exit 0
+#endif
+#include <stdlib.h>
+#include <stdint.h>
+#include "slab_alloc.h"
+
+#define GRANULE 16
+
+/* Sizes of each class, spaced to bound internal waste at about 25% */
+static const size_t class_size[SLAB_ALLOC_CLASSES] = {
+	16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448, 512
+};
+
+/* Class index for each size in granules (rounded up) */
+static const uint8_t class_of[SLAB_ALLOC_MAX_SIZE / GRANULE + 1] = {
+	0, 0, 1, 2, 3, 4, 5, 6, 7,
+	8, 8, 9, 9, 10, 10, 11, 11,
+	12, 12, 12, 12, 13, 13, 13, 13,
+	14, 14, 14, 14, 15, 15, 15, 15
+};
+
+static void *slab_alloc_proxy(void *arg, size_t size)
+{
+	return slab_alloc_new(arg, size);
+}
+
+static void slab_free_proxy(void *arg, void *ptr, size_t size)
+{
+	slab_alloc_delete(arg, ptr, size);
+}
+
+void slab_alloc_init(struct slab_alloc *inst)
+{
+	for (size_t i = 0; i < SLAB_ALLOC_CLASSES; i++) {
+		block_alloc_init(&inst->classes[i], class_size[i]);
+	}
+	inst->allocator.alloc = slab_alloc_proxy;
+	inst->allocator.free = slab_free_proxy;
+	inst->allocator.arg = inst;
+}
+
+void slab_alloc_destroy(struct slab_alloc *inst)
+{
+	for (size_t i = 0; i < SLAB_ALLOC_CLASSES; i++) {
+		block_alloc_destroy(&inst->classes[i]);
+	}
+}
+
+void *slab_alloc_new(struct slab_alloc *inst, size_t size)
+{
+	if (size > SLAB_ALLOC_MAX_SIZE) {
+		return malloc(size);
+	}
+	return block_alloc_new(&inst->classes[class_of[(size + GRANULE - 1) / GRANULE]]);
+}
+
+void slab_alloc_delete(struct slab_alloc *inst, void *ptr, size_t size)
+{
+	if (size > SLAB_ALLOC_MAX_SIZE) {
+		free(ptr);
+		return;
+	}
+	block_alloc_delete(&inst->classes[class_of[(size + GRANULE - 1) / GRANULE]], ptr);
+}
+
+const struct allocator *slab_alloc_allocator(struct slab_alloc *inst)
+{
+	return &inst->allocator;
+}
+
+#if defined TEST_slab_alloc
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "binary_tree.h"
+
+/* Every size up to past the largest class, data must not overlap */
+static void test_sizes(void)
+{
+	struct slab_alloc sa;
+	slab_alloc_init(&sa);
+	const size_t max = SLAB_ALLOC_MAX_SIZE + 64;
+	void **items = malloc((max + 1) * sizeof(*items));
+	for (size_t size = 0; size <= max; size++) {
+		items[size] = slab_alloc_new(&sa, size);
+		memset(items[size], (int) size, size);
+	}
+	size_t corrupted = 0;
+	for (size_t size = 0; size <= max; size++) {
+		const unsigned char *p = items[size];
+		for (size_t i = 0; i < size; i++) {
+			if (p[i] != (unsigned char) size) {
+				corrupted++;
+				break;
+			}
+		}
+		slab_alloc_delete(&sa, items[size], size);
+	}
+	free(items);
+	slab_alloc_destroy(&sa);
+	printf("Sizes 0-%zu: %zu items corrupted\n", max, corrupted);
+}
+
+/* Build then destroy a tree of random keys with mixed lengths */
+static double bench_tree(const struct allocator *alloc, size_t n, size_t rounds)
+{
+	char key[128];
+	struct binary_tree tree;
+	binary_tree_init(&tree, NULL, NULL, NULL);
+	binary_tree_set_allocator(&tree, alloc);
+	clock_t start = clock();
+	for (size_t r = 0; r < rounds; r++) {
+		for (size_t i = 0; i < n; i++) {
+			const size_t length = 8 + rand() % (sizeof(key) - 8);
+			for (size_t j = 0; j < length; j++) {
+				key[j] = 'a' + rand() % 26;
+			}
+			binary_tree_insert_new(&tree, key, length);
+		}
+		binary_tree_clear(&tree);
+	}
+	return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char *argv[])
+{
+	const size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+	const size_t rounds = argc > 2 ? strtoul(argv[2], NULL, 10) : 5;
+	test_sizes();
+
+	struct slab_alloc sa;
+	slab_alloc_init(&sa);
+	printf("Tree of %zu mixed-length keys, %zu rounds\n", n, rounds);
+	printf(" * malloc: %.3fs\n", bench_tree(NULL, n, rounds));
+	printf(" * slab:   %.3fs\n", bench_tree(slab_alloc_allocator(&sa), n, rounds));
+	slab_alloc_destroy(&sa);
+	return 0;
+}
+#endif
@@ -0,0 +1,29 @@
+#pragma once
+#include <stddef.h>
+#include "allocator.h"
+#include "block_alloc.h"
+
+/*
+ * Size-class front end for block_alloc: requests up to SLAB_ALLOC_MAX_SIZE
+ * bytes are served from the block_alloc of the smallest class that fits,
+ * larger requests go to malloc.  Frees must pass the allocation size.
+ * Not thread-safe.
+ */
+
+#define SLAB_ALLOC_CLASSES 16
+#define SLAB_ALLOC_MAX_SIZE 512
+
+struct slab_alloc {
+	struct block_alloc classes[SLAB_ALLOC_CLASSES];
+	/* Interface for containers, see slab_alloc_allocator */
+	struct allocator allocator;
+};
+
+void slab_alloc_init(struct slab_alloc *inst);
+void slab_alloc_destroy(struct slab_alloc *inst);
+
+void *slab_alloc_new(struct slab_alloc *inst, size_t size);
+void slab_alloc_delete(struct slab_alloc *inst, void *ptr, size_t size);
+
+/* For passing to containers, valid for the life of inst */
+const struct allocator *slab_alloc_allocator(struct slab_alloc *inst);
@@ -0,0 +1,189 @@
+#if 0
+(
+set -euo pipefail
+declare -r tmp="$(mktemp)"
+gcc -I./c_modules -Wall -Wextra -Werror -std=c11 -O0 -g -pthread -DTEST_spsc_queue -o "$tmp" *.c
+exec valgrind --quiet --leak-check=full --track-origins=yes "$tmp"
+)
+exit 0
+#endif
+#include <cstd/std.h>
+#include "spsc_queue.h"
+
+void spsc_queue_init(struct spsc_queue *inst, size_t item_size, size_t capacity)
+{
+	size_t size = 1;
+	while (size < capacity) {
+		size <<= 1;
+	}
+	buffer_init_growth(&inst->ring, item_size, size, BUFFER_GROW_FIXED, size);
+	inst->mask = size - 1;
+	atomic_init(&inst->head, 0);
+	atomic_init(&inst->tail, 0);
+	inst->tail_cache = 0;
+	inst->head_cache = 0;
+}
+
+/* Items which fit before the ring wraps, starting at position <pos> */
+static size_t ring_first(const struct spsc_queue *inst, size_t pos, size_t n)
+{
+	const size_t room = inst->mask + 1 - (pos & inst->mask);
+	return n < room ? n : room;
+}
+
+/* Copy n items into the ring at position <pos>, wrapping as needed */
+static void ring_write(struct spsc_queue *inst, size_t pos, const void *items, size_t n)
+{
+	const size_t item_size = inst->ring.item_size;
+	const size_t first = ring_first(inst, pos, n);
+	const char *p = items;
+	memcpy(buffer_ptr(&inst->ring, pos & inst->mask), p, first * item_size);
+	memcpy(buffer_ptr(&inst->ring, 0), p + first * item_size, (n - first) * item_size);
+}
+
+/* Copy n items out of the ring from position <pos>, wrapping as needed */
+static void ring_read(const struct spsc_queue *inst, size_t pos, void *items, size_t n)
+{
+	const size_t item_size = inst->ring.item_size;
+	const size_t first = ring_first(inst, pos, n);
+	char *p = items;
+	memcpy(p, buffer_cptr(&inst->ring, pos & inst->mask), first * item_size);
+	memcpy(p + first * item_size, buffer_cptr(&inst->ring, 0), (n - first) * item_size);
+}
+
+size_t spsc_queue_push_n(struct spsc_queue *inst, const void *in, size_t n)
+{
+	const size_t tail = atomic_load_explicit(&inst->tail, memory_order_relaxed);
+	const size_t capacity = inst->mask + 1;
+	if (capacity - (tail - inst->head_cache) < n) {
+		inst->head_cache = atomic_load_explicit(&inst->head, memory_order_acquire);
+		const size_t space = capacity - (tail - inst->head_cache);
+		if (space < n) {
+			n = space;
+		}
+	}
+	if (n == 0) {
+		return 0;
+	}
+	ring_write(inst, tail, in, n);
+	atomic_store_explicit(&inst->tail, tail + n, memory_order_release);
+	return n;
+}
+
+size_t spsc_queue_pop_n(struct spsc_queue *inst, void *out, size_t n)
+{
+	const size_t head = atomic_load_explicit(&inst->head, memory_order_relaxed);
+	if (inst->tail_cache - head < n) {
+		inst->tail_cache = atomic_load_explicit(&inst->tail, memory_order_acquire);
+		const size_t available = inst->tail_cache - head;
+		if (available < n) {
+			n = available;
+		}
+	}
+	if (n == 0) {
+		return 0;
+	}
+	ring_read(inst, head, out, n);
+	atomic_store_explicit(&inst->head, head + n, memory_order_release);
+	return n;
+}
+
+bool spsc_queue_push(struct spsc_queue *inst, const void *in)
+{
+	return spsc_queue_push_n(inst, in, 1) == 1;
+}
+
+bool spsc_queue_pop(struct spsc_queue *inst, void *out)
+{
+	return spsc_queue_pop_n(inst, out, 1) == 1;
+}
+
+size_t spsc_queue_size(struct spsc_queue *inst)
+{
+	const size_t head = atomic_load_explicit(&inst->head, memory_order_acquire);
+	const size_t tail = atomic_load_explicit(&inst->tail, memory_order_acquire);
+	return tail - head;
+}
+
+size_t spsc_queue_capacity(const struct spsc_queue *inst)
+{
+	return inst->mask + 1;
+}
+
+void spsc_queue_destroy(struct spsc_queue *inst)
+{
+	buffer_destroy(&inst->ring);
+}
+
+#if defined TEST_spsc_queue
+#include <threads.h>
+#include <time.h>
+
+struct bench {
+	struct spsc_queue queue;
+	size_t count;
+	size_t batch;
+};
+
+static int producer(void *arg)
+{
+	struct bench *b = arg;
+	size_t items[64];
+	for (size_t i = 0; i < b->count; ) {
+		size_t n = b->count - i < b->batch ? b->count - i : b->batch;
+		for (size_t j = 0; j < n; j++) {
+			items[j] = i + j;
+		}
+		size_t done = 0;
+		while (done < n) {
+			const size_t pushed = spsc_queue_push_n(&b->queue, items + done, n - done);
+			if (pushed == 0) {
+				thrd_yield();
+			}
+			done += pushed;
+		}
+		i += n;
+	}
+	return 0;
+}
+
+static void bench_spsc(size_t count, size_t batch)
+{
+	struct bench b = { .count = count, .batch = batch };
+	struct timespec start;
+	struct timespec end;
+	thrd_t thread;
+	size_t items[64];
+	size_t expect = 0;
+	size_t errors = 0;
+	spsc_queue_init(&b.queue, sizeof(size_t), 1024);
+	timespec_get(&start, TIME_UTC);
+	thrd_create(&thread, producer, &b);
+	while (expect < count) {
+		const size_t n = spsc_queue_pop_n(&b.queue, items, batch);
+		if (n == 0) {
+			thrd_yield();
+		}
+		for (size_t i = 0; i < n; i++) {
+			errors += items[i] != expect++;
+		}
+	}
+	thrd_join(thread, NULL);
+	timespec_get(&end, TIME_UTC);
+	const double t = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+	printf(" * batch=%-3zu %zu items in %.4fs (%.1f Mitems/s), errors=%zu\n", batch, count, t, count / t * 1e-6, errors);
+	spsc_queue_destroy(&b.queue);
+}
+
+int main(int argc, char *argv[])
+{
+	const size_t count = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+
+	printf("SPSC throughput\n");
+	bench_spsc(count, 1);
+	bench_spsc(count, 16);
+	bench_spsc(count, 64);
+	printf("\n");
+	return 0;
+}
+#endif
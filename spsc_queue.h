@@ -0,0 +1,40 @@
+#pragma once
+#include <cstd/std.h>
+#include <stdatomic.h>
+#include "buffer.h"
+#include "cache_line.h"
+
+/*
+ * Bounded wait-free single-producer/single-consumer queue of fixed-size items,
+ * stored inline in a power-of-two ring.  Exactly one thread may push and one
+ * thread may pop concurrently.
+ */
+
+struct spsc_queue {
+	struct buffer ring;
+	size_t mask;
+	/* Consumer-owned: read position and last seen write position */
+	_Alignas(CACHE_LINE_SIZE) atomic_size_t head;
+	size_t tail_cache;
+	/* Producer-owned: write position and last seen read position */
+	_Alignas(CACHE_LINE_SIZE) atomic_size_t tail;
+	size_t head_cache;
+};
+
+/* Capacity is rounded up to a power of two */
+void spsc_queue_init(struct spsc_queue *inst, size_t item_size, size_t capacity);
+
+/* Returns false if full */
+bool spsc_queue_push(struct spsc_queue *inst, const void *in);
+/* Returns false if empty */
+bool spsc_queue_pop(struct spsc_queue *inst, void *out);
+
+/* Push/pop up to n items, returns number transferred */
+size_t spsc_queue_push_n(struct spsc_queue *inst, const void *in, size_t n);
+size_t spsc_queue_pop_n(struct spsc_queue *inst, void *out, size_t n);
+
+/* Approximate when called concurrently with push/pop */
+size_t spsc_queue_size(struct spsc_queue *inst);
+size_t spsc_queue_capacity(const struct spsc_queue *inst);
+
+void spsc_queue_destroy(struct spsc_queue *inst);
@@ -0,0 +1,468 @@
+#if 0
+(
+set -euo pipefail
+declare -r tmp="$(mktemp)"
+gcc -I./c_modules -Wall -Wextra -Werror -std=c11 -O0 -g -pthread -DTEST_unrolled_list -o "$tmp" *.c
+exec valgrind --quiet --leak-check=full --track-origins=yes "$tmp"
+)
+exit 0
+#endif
+#include <cstd/std.h>
+#include "unrolled_list.h"
+
+/* Proxies for stateless list operators */
+
+static void iterate_proxy(void *state, void *item)
+{
+	list_iterator *cb = (list_iterator *) state;
+	cb(item);
+}
+
+static bool predicate_proxy(void *state, void *item)
+{
+	list_predicate *cb = (list_predicate *) state;
+	return cb(item);
+}
+
+static void transform_proxy(void *item, struct list **out, void *state)
+{
+	list_transformer *cb = (list_transformer *) state;
+	cb(item, out);
+}
+
+static void *item_at(const struct unrolled_list *inst, struct unrolled_list_node *node, size_t index)
+{
+	return node->data + index * inst->item_size;
+}
+
+static struct unrolled_list_node *node_alloc(const struct unrolled_list *inst, size_t start)
+{
+	struct unrolled_list_node *node = malloc(sizeof(*node) + inst->node_items * inst->item_size);
+	if (node == NULL) {
+		exit(12);
+	}
+	node->prev = NULL;
+	node->next = NULL;
+	node->start = start;
+	node->count = 0;
+	return node;
+}
+
+static void node_free_from(struct unrolled_list_node *node)
+{
+	while (node != NULL) {
+		struct unrolled_list_node *next = node->next;
+		free(node);
+		node = next;
+	}
+}
+
+bool unrolled_list_init(struct unrolled_list *inst, size_t item_size, size_t node_size)
+{
+	if (node_size == 0) {
+		node_size = UNROLLED_LIST_DEFAULT_NODE_SIZE;
+	}
+	inst->head = NULL;
+	inst->tail = NULL;
+	inst->item_size = item_size;
+	inst->node_items = 1;
+	inst->length = 0;
+	if (item_size == 0) {
+		errno = EINVAL;
+		return false;
+	}
+	if (node_size > sizeof(struct unrolled_list_node) && (node_size - sizeof(struct unrolled_list_node)) / item_size > 1) {
+		inst->node_items = (node_size - sizeof(struct unrolled_list_node)) / item_size;
+	}
+	return true;
+}
+
+void unrolled_list_destroy(struct unrolled_list *inst)
+{
+	node_free_from(inst->head);
+	inst->head = NULL;
+	inst->tail = NULL;
+	inst->length = 0;
+}
+
+bool unrolled_list_empty(const struct unrolled_list *inst)
+{
+	return inst->length == 0;
+}
+
+size_t unrolled_list_length(const struct unrolled_list *inst)
+{
+	return inst->length;
+}
+
+void *unrolled_list_push_front(struct unrolled_list *inst, const void *in)
+{
+	struct unrolled_list_node *node = inst->head;
+	if (node == NULL || node->start == 0) {
+		/* New head fills from its end */
+		node = node_alloc(inst, inst->node_items);
+		node->next = inst->head;
+		if (inst->head) {
+			inst->head->prev = node;
+		} else {
+			inst->tail = node;
+		}
+		inst->head = node;
+	}
+	node->start--;
+	node->count++;
+	inst->length++;
+	void *item = item_at(inst, node, node->start);
+	if (in != NULL) {
+		memcpy(item, in, inst->item_size);
+	}
+	return item;
+}
+
+void *unrolled_list_push_back(struct unrolled_list *inst, const void *in)
+{
+	struct unrolled_list_node *node = inst->tail;
+	if (node == NULL || node->start + node->count == inst->node_items) {
+		node = node_alloc(inst, 0);
+		node->prev = inst->tail;
+		if (inst->tail) {
+			inst->tail->next = node;
+		} else {
+			inst->head = node;
+		}
+		inst->tail = node;
+	}
+	void *item = item_at(inst, node, node->start + node->count);
+	node->count++;
+	inst->length++;
+	if (in != NULL) {
+		memcpy(item, in, inst->item_size);
+	}
+	return item;
+}
+
+bool unrolled_list_pop_front(struct unrolled_list *inst, void *out)
+{
+	struct unrolled_list_node *node = inst->head;
+	if (node == NULL) {
+		return false;
+	}
+	if (out != NULL) {
+		memcpy(out, item_at(inst, node, node->start), inst->item_size);
+	}
+	node->start++;
+	node->count--;
+	inst->length--;
+	if (node->count == 0) {
+		inst->head = node->next;
+		if (inst->head) {
+			inst->head->prev = NULL;
+		} else {
+			inst->tail = NULL;
+		}
+		free(node);
+	}
+	return true;
+}
+
+bool unrolled_list_pop_back(struct unrolled_list *inst, void *out)
+{
+	struct unrolled_list_node *node = inst->tail;
+	if (node == NULL) {
+		return false;
+	}
+	node->count--;
+	inst->length--;
+	if (out != NULL) {
+		memcpy(out, item_at(inst, node, node->start + node->count), inst->item_size);
+	}
+	if (node->count == 0) {
+		inst->tail = node->prev;
+		if (inst->tail) {
+			inst->tail->next = NULL;
+		} else {
+			inst->head = NULL;
+		}
+		free(node);
+	}
+	return true;
+}
+
+void *unrolled_list_front(struct unrolled_list *inst)
+{
+	return inst->head ? item_at(inst, inst->head, inst->head->start) : NULL;
+}
+
+void *unrolled_list_back(struct unrolled_list *inst)
+{
+	return inst->tail ? item_at(inst, inst->tail, inst->tail->start + inst->tail->count - 1) : NULL;
+}
+
+size_t unrolled_list_each(struct unrolled_list *inst, list_iterator *cb)
+{
+	return unrolled_list_each_s(inst, iterate_proxy, (void *) cb);
+}
+
+size_t unrolled_list_each_s(struct unrolled_list *inst, list_stateful_iterator *cb, void *state)
+{
+	const size_t size = inst->item_size;
+	for (struct unrolled_list_node *node = inst->head; node != NULL; node = node->next) {
+		char *item = item_at(inst, node, node->start);
+		char *end = item + node->count * size;
+		for (; item != end; item += size) {
+			cb(state, item);
+		}
+	}
+	return inst->length;
+}
+
+size_t unrolled_list_count(struct unrolled_list *inst, list_predicate *cb)
+{
+	return unrolled_list_count_s(inst, predicate_proxy, (void *) cb);
+}
+
+size_t unrolled_list_count_s(struct unrolled_list *inst, list_stateful_predicate *cb, void *state)
+{
+	const size_t size = inst->item_size;
+	size_t count = 0;
+	for (struct unrolled_list_node *node = inst->head; node != NULL; node = node->next) {
+		char *item = item_at(inst, node, node->start);
+		char *end = item + node->count * size;
+		for (; item != end; item += size) {
+			count += cb(state, item) ? 1 : 0;
+		}
+	}
+	return count;
+}
+
+size_t unrolled_list_filter(struct unrolled_list *inst, list_predicate *cb)
+{
+	return unrolled_list_filter_s(inst, predicate_proxy, (void *) cb);
+}
+
+size_t unrolled_list_filter_s(struct unrolled_list *inst, list_stateful_predicate *cb, void *state)
+{
+	if (inst->head == NULL) {
+		return 0;
+	}
+	/*
+	 * Survivors are copied to a write cursor which never passes the read
+	 * cursor, the read node's bounds are taken before the write cursor can
+	 * reach (and rewrite) them
+	 */
+	const size_t size = inst->item_size;
+	struct unrolled_list_node *w = inst->head;
+	size_t wstart = w->start;
+	size_t wpos = w->start;
+	size_t kept = 0;
+	for (struct unrolled_list_node *r = inst->head; r != NULL; r = r->next) {
+		const size_t end = r->start + r->count;
+		for (size_t i = r->start; i < end; i++) {
+			char *item = item_at(inst, r, i);
+			if (!cb(state, item)) {
+				continue;
+			}
+			if (wpos == inst->node_items) {
+				w->start = wstart;
+				w->count = wpos - wstart;
+				w = w->next;
+				wstart = 0;
+				wpos = 0;
+			}
+			char *to = item_at(inst, w, wpos);
+			if (to != item) {
+				memcpy(to, item, size);
+			}
+			wpos++;
+			kept++;
+		}
+	}
+	const size_t removed = inst->length - kept;
+	struct unrolled_list_node *rest;
+	if (kept == 0) {
+		rest = inst->head;
+		inst->head = NULL;
+		inst->tail = NULL;
+	} else {
+		w->start = wstart;
+		w->count = wpos - wstart;
+		rest = w->next;
+		w->next = NULL;
+		inst->tail = w;
+	}
+	node_free_from(rest);
+	inst->length = kept;
+	return removed;
+}
+
+struct list *unrolled_list_map(struct unrolled_list *inst, list_transformer *cb)
+{
+	return unrolled_list_map_s(inst, transform_proxy, (void *) cb);
+}
+
+struct list *unrolled_list_map_s(struct unrolled_list *inst, list_stateful_transformer *cb, void *state)
+{
+	const size_t size = inst->item_size;
+	struct list *out = NULL;
+	for (struct unrolled_list_node *node = inst->head; node != NULL; node = node->next) {
+		char *item = item_at(inst, node, node->start);
+		char *end = item + node->count * size;
+		for (; item != end; item += size) {
+			cb(item, &out, state);
+		}
+	}
+	return out;
+}
+
+void *unrolled_list_first(struct unrolled_list *inst, list_predicate *cb)
+{
+	return unrolled_list_first_s(inst, predicate_proxy, (void *) cb);
+}
+
+void *unrolled_list_first_s(struct unrolled_list *inst, list_stateful_predicate *cb, void *state)
+{
+	const size_t size = inst->item_size;
+	for (struct unrolled_list_node *node = inst->head; node != NULL; node = node->next) {
+		char *item = item_at(inst, node, node->start);
+		char *end = item + node->count * size;
+		for (; item != end; item += size) {
+			if (cb(state, item)) {
+				return item;
+			}
+		}
+	}
+	return NULL;
+}
+
+#if defined TEST_unrolled_list
+#include <inttypes.h>
+#include <time.h>
+
+static void sum_item(void *state, void *data)
+{
+	*(uint64_t *) state += *(uint64_t *) data;
+}
+
+static bool is_even(void *data)
+{
+	return *(uint64_t *) data % 2 == 0;
+}
+
+static bool keep_mod3(void *state, void *data)
+{
+	(void) state;
+	return *(uint64_t *) data % 3 == 0;
+}
+
+static void negate(void *data, struct list **out)
+{
+	int64_t x = -(int64_t) *(uint64_t *) data;
+	list_insert_before(out, sizeof(x), &x);
+}
+
+static void test_ops(void)
+{
+	struct unrolled_list ul;
+	/* Tiny nodes to exercise node boundaries */
+	unrolled_list_init(&ul, sizeof(uint64_t), sizeof(struct unrolled_list_node) + 3 * sizeof(uint64_t));
+	for (uint64_t i = 10; i < 20; i++) {
+		unrolled_list_push_back(&ul, &i);
+	}
+	for (uint64_t i = 10; i-- > 0; ) {
+		unrolled_list_push_front(&ul, &i);
+	}
+	uint64_t sum = 0;
+	unrolled_list_each_s(&ul, sum_item, &sum);
+	printf("Length %zu, sum %" PRIu64 ", even %zu\n", unrolled_list_length(&ul), sum, unrolled_list_count(&ul, is_even));
+	printf("Removed %zu not divisible by 3:", unrolled_list_filter_s(&ul, keep_mod3, NULL));
+	uint64_t expect = 0;
+	for (struct unrolled_list_node *node = ul.head; node != NULL; node = node->next) {
+		for (size_t i = 0; i < node->count; i++) {
+			uint64_t x = *(uint64_t *) item_at(&ul, node, node->start + i);
+			printf(" %" PRIu64, x);
+			if (x != expect) {
+				printf("\nOrder broken\n");
+				exit(1);
+			}
+			expect += 3;
+		}
+	}
+	printf("\n");
+	struct list *neg = unrolled_list_map(&ul, negate);
+	printf("Mapped %zu, first %" PRId64 "\n", list_length(neg), *(int64_t *) neg->data);
+	list_destroy(&neg);
+	uint64_t x;
+	unrolled_list_pop_front(&ul, &x);
+	printf("Pop front %" PRIu64, x);
+	unrolled_list_pop_back(&ul, &x);
+	printf(", pop back %" PRIu64 ", length %zu\n", x, unrolled_list_length(&ul));
+	unrolled_list_destroy(&ul);
+	printf("Zero item size rejected: %d\n", !unrolled_list_init(&ul, 0, 0) && errno == EINVAL);
+	unrolled_list_destroy(&ul);
+}
+
+static bool is_even_s(void *state, void *data)
+{
+	(void) state;
+	return is_even(data);
+}
+
+/* Sum and count over n items in struct list versus unrolled_list */
+static void bench_scan(size_t n, size_t rounds)
+{
+	struct list *list = NULL;
+	struct unrolled_list ul;
+	unrolled_list_init(&ul, sizeof(uint64_t), 0);
+	/* Interleave with other allocations as a long-lived list would be */
+	void **noise = malloc(n * sizeof(*noise));
+	for (uint64_t i = 0; i < n; i++) {
+		list_insert_before(&list, sizeof(i), &i);
+		noise[i] = malloc(48);
+		unrolled_list_push_back(&ul, &i);
+	}
+	for (size_t i = 0; i < n; i++) {
+		free(noise[i]);
+	}
+	free(noise);
+
+	uint64_t sum = 0;
+	size_t count = 0;
+	clock_t start = clock();
+	for (size_t r = 0; r < rounds; r++) {
+		list_each_s(list, sum_item, &sum);
+		count += list_count_s(list, is_even_s, NULL);
+	}
+	const double t_list = (double) (clock() - start) / CLOCKS_PER_SEC;
+	start = clock();
+	for (size_t r = 0; r < rounds; r++) {
+		unrolled_list_each_s(&ul, sum_item, &sum);
+		count += unrolled_list_count_s(&ul, is_even_s, NULL);
+	}
+	const double t_unrolled = (double) (clock() - start) / CLOCKS_PER_SEC;
+	printf("Scan %zu items x %zu (checksum %" PRIu64 "/%zu)\n", n, rounds, sum, count);
+	printf(" * list:          %.3fs\n", t_list);
+	printf(" * unrolled_list: %.3fs\n", t_unrolled);
+
+	start = clock();
+	list_filter_s(&list, keep_mod3, NULL);
+	const double f_list = (double) (clock() - start) / CLOCKS_PER_SEC;
+	start = clock();
+	unrolled_list_filter_s(&ul, keep_mod3, NULL);
+	const double f_unrolled = (double) (clock() - start) / CLOCKS_PER_SEC;
+	printf("Filter (%zu/%zu left)\n", list_length(list), unrolled_list_length(&ul));
+	printf(" * list:          %.3fs\n", f_list);
+	printf(" * unrolled_list: %.3fs\n", f_unrolled);
+
+	list_destroy(&list);
+	unrolled_list_destroy(&ul);
+}
+
+int main(int argc, char *argv[])
+{
+	const size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+	const size_t rounds = argc > 2 ? strtoul(argv[2], NULL, 10) : 10;
+	test_ops();
+	bench_scan(n, rounds);
+	return 0;
+}
+#endif
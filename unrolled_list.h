@@ -0,0 +1,74 @@
+#pragma once
+#include <cstd/std.h>
+#include "linked_list.h"
+
+/*
+ * Unrolled double-linked list of fixed-size items: each node holds a
+ * contiguous run of items, so scans stream through memory instead of
+ * chasing a pointer per item.  Callbacks use the linked_list.h types.
+ */
+
+#define UNROLLED_LIST_DEFAULT_NODE_SIZE 1024
+
+struct unrolled_list_node {
+	struct unrolled_list_node *prev;
+	struct unrolled_list_node *next;
+	/* Index of first item in data */
+	size_t start;
+	size_t count;
+	_Alignas(max_align_t) char data[];
+};
+
+struct unrolled_list {
+	struct unrolled_list_node *head;
+	struct unrolled_list_node *tail;
+	size_t item_size;
+	/* Items per node */
+	size_t node_items;
+	size_t length;
+};
+
+/*
+ * Node size is in bytes including the header, 0 for the default.  Returns
+ * false (with errno set to EINVAL) for a zero item size, leaving an empty
+ * list which may still be destroyed.
+ */
+bool unrolled_list_init(struct unrolled_list *inst, size_t item_size, size_t node_size);
+void unrolled_list_destroy(struct unrolled_list *inst);
+
+bool unrolled_list_empty(const struct unrolled_list *inst);
+size_t unrolled_list_length(const struct unrolled_list *inst);
+
+/* Returns pointer to the new item, which is copied from <in> if non-NULL */
+void *unrolled_list_push_front(struct unrolled_list *inst, const void *in);
+void *unrolled_list_push_back(struct unrolled_list *inst, const void *in);
+
+/* Returns false if empty, copies the item to <out> if non-NULL */
+bool unrolled_list_pop_front(struct unrolled_list *inst, void *out);
+bool unrolled_list_pop_back(struct unrolled_list *inst, void *out);
+
+void *unrolled_list_front(struct unrolled_list *inst);
+void *unrolled_list_back(struct unrolled_list *inst);
+
+/* Iterator over each item in the list.  *_s can can be used for reduce/fold */
+size_t unrolled_list_each(struct unrolled_list *inst, list_iterator *cb);
+size_t unrolled_list_each_s(struct unrolled_list *inst, list_stateful_iterator *cb, void *state);
+
+/* Count for how many items the predicate returns true */
+size_t unrolled_list_count(struct unrolled_list *inst, list_predicate *cb);
+size_t unrolled_list_count_s(struct unrolled_list *inst, list_stateful_predicate *cb, void *state);
+
+/*
+ * Remove all items for which the predicate returns false, returns number of
+ * items removed.  Survivors are compacted so nodes stay full.
+ */
+size_t unrolled_list_filter(struct unrolled_list *inst, list_predicate *cb);
+size_t unrolled_list_filter_s(struct unrolled_list *inst, list_stateful_predicate *cb, void *state);
+
+/* As list_map, generating a struct list from each item */
+struct list *unrolled_list_map(struct unrolled_list *inst, list_transformer *cb);
+struct list *unrolled_list_map_s(struct unrolled_list *inst, list_stateful_transformer *cb, void *state);
+
+/* Returns first item for which predicate is true */
+void *unrolled_list_first(struct unrolled_list *inst, list_predicate *cb);
+void *unrolled_list_first_s(struct unrolled_list *inst, list_stateful_predicate *cb, void *state);